@@ -0,0 +1,698 @@
+#include "main.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+// Allocator benchmark: runs each workload against every pool mode, the
+// segregated mode's next and best fit policies and fast bins, and the system malloc and
+// reports throughput, per-operation latency percentiles and peak
+// fragmentation, then how sharded pools scale with threads. Built and run
+// with `make bench`; `--replay file` runs a trace recorded with
+// magic_trace_start through every allocator instead.
+
+#define POOL_BYTES ((size_t)256 * 1024 * 1024)
+#define MAX_OPS 300000                      // largest number of operations in a built-in workload
+
+static size_t sample_capacity = MAX_OPS;    // raised to fit a replayed trace
+
+/// ------------------------------- ALLOCATORS ------------------------------- //
+
+typedef struct Allocator {
+    const char* name;
+    MagicPoolMode mode;
+    MagicFitPolicy fit;
+    int fast_bins;
+    int system;                 // glibc malloc instead of a magic pool
+    MagicPool* pool;
+    size_t baseline;            // resident bytes when the run started
+} Allocator;
+
+static Allocator allocators[] = {
+    { .name = "segregated", .mode = MAGIC_MODE_SEGREGATED },
+    { .name = "next-fit", .mode = MAGIC_MODE_SEGREGATED, .fit = MAGIC_FIT_NEXT },
+    { .name = "best-fit", .mode = MAGIC_MODE_SEGREGATED, .fit = MAGIC_FIT_BEST },
+    { .name = "fast-bins", .mode = MAGIC_MODE_SEGREGATED, .fast_bins = 1 },
+    { .name = "tlsf", .mode = MAGIC_MODE_TLSF },
+    { .name = "buddy", .mode = MAGIC_MODE_BUDDY },
+    { .name = "glibc", .system = 1 },
+};
+
+// Resident set size of the process, the memory the heap actually touched.
+static size_t resident_bytes() {
+    static long page_size;
+    if (!page_size) page_size = sysconf(_SC_PAGESIZE);
+    unsigned long total = 0, resident = 0;
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (!statm) return 0;
+    if (fscanf(statm, "%lu %lu", &total, &resident) != 2) resident = 0;
+    fclose(statm);
+    return (size_t)resident * (size_t)page_size;
+}
+
+// Pools start from a fresh mapping; glibc hands its cached free pages back
+// first, so every run starts from the same resident baseline.
+static void allocator_begin(Allocator* allocator) {
+    if (allocator->system) {
+        malloc_trim(0);
+    }
+    else {
+        allocator->pool = magic_pool_create_mode(POOL_BYTES, allocator->mode);
+        magic_pool_set_fit(allocator->pool, allocator->fit);
+        magic_pool_set_fast_bins(allocator->pool, allocator->fast_bins);
+    }
+    allocator->baseline = resident_bytes();
+}
+
+static void allocator_end(Allocator* allocator) {
+    if (!allocator->system) {
+        magic_pool_destroy(allocator->pool);
+        allocator->pool = NULL;
+    }
+}
+
+static void* allocator_malloc(Allocator* allocator, size_t size) {
+    if (allocator->system) return malloc(size);
+    return magic_pool_malloc(allocator->pool, size);
+}
+
+static void* allocator_calloc(Allocator* allocator, size_t size) {
+    if (allocator->system) return calloc(1, size);
+    return magic_pool_calloc(allocator->pool, 1, size);
+}
+
+static void* allocator_memalign(Allocator* allocator, size_t alignment, size_t size) {
+    if (allocator->system) return aligned_alloc(alignment, size);
+    return magic_pool_memalign(allocator->pool, alignment, size);
+}
+
+static void* allocator_realloc(Allocator* allocator, void* ptr, size_t size) {
+    if (allocator->system) return realloc(ptr, size);
+    return magic_pool_realloc(allocator->pool, ptr, size);
+}
+
+static void allocator_free(Allocator* allocator, void* ptr) {
+    if (allocator->system) free(ptr);
+    else magic_pool_free(allocator->pool, ptr);
+}
+
+// Bytes the heap has made resident during this run.
+static size_t allocator_footprint(Allocator* allocator) {
+    size_t resident = resident_bytes();
+    return resident > allocator->baseline ? resident - allocator->baseline : 0;
+}
+
+/// ------------------------------- RUNS ------------------------------- //
+
+// One workload against one allocator. The throughput pass leaves samples
+// NULL; the latency pass times every call and samples the footprint.
+typedef struct Run {
+    Allocator* allocator;
+    uint64_t* samples;          // per-call latency in ns, indexed by ops
+    size_t ops;
+    size_t failures;
+    size_t live;                // requested bytes currently allocated
+    size_t peak_live;
+    size_t peak_footprint;
+} Run;
+
+static uint64_t now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+// Counts a call and stores its latency. The producer/consumer workload
+// records from two threads, so the slot is claimed atomically.
+static void record(Run* run, uint64_t start) {
+    size_t index = __atomic_fetch_add(&run->ops, 1, __ATOMIC_RELAXED);
+    if (run->samples && index < sample_capacity) {
+        run->samples[index] = now_ns() - start;
+    }
+}
+
+static void account(Run* run, void* ptr, size_t size) {
+    if (!ptr) {
+        run->failures++;
+        return;
+    }
+    size_t live = __atomic_add_fetch(&run->live, size, __ATOMIC_RELAXED);
+    if (live > run->peak_live) {
+        run->peak_live = live;
+    }
+}
+
+static void* run_malloc(Run* run, size_t size) {
+    uint64_t start = run->samples ? now_ns() : 0;
+    void* ptr = allocator_malloc(run->allocator, size);
+    record(run, start);
+    account(run, ptr, size);
+    return ptr;
+}
+
+static void* run_calloc(Run* run, size_t size) {
+    uint64_t start = run->samples ? now_ns() : 0;
+    void* ptr = allocator_calloc(run->allocator, size);
+    record(run, start);
+    account(run, ptr, size);
+    return ptr;
+}
+
+static void* run_memalign(Run* run, size_t alignment, size_t size) {
+    uint64_t start = run->samples ? now_ns() : 0;
+    void* ptr = allocator_memalign(run->allocator, alignment, size);
+    record(run, start);
+    account(run, ptr, size);
+    return ptr;
+}
+
+// Resizes a block of old_size bytes; on failure the old block stays live.
+static void* run_realloc(Run* run, void* ptr, size_t old_size, size_t size) {
+    uint64_t start = run->samples ? now_ns() : 0;
+    void* new_ptr = allocator_realloc(run->allocator, ptr, size);
+    record(run, start);
+    if (new_ptr) {
+        __atomic_sub_fetch(&run->live, old_size, __ATOMIC_RELAXED);
+    }
+    account(run, new_ptr, size);
+    return new_ptr;
+}
+
+static void run_free(Run* run, void* ptr, size_t size) {
+    if (!ptr) return;
+    uint64_t start = run->samples ? now_ns() : 0;
+    allocator_free(run->allocator, ptr);
+    record(run, start);
+    __atomic_sub_fetch(&run->live, size, __ATOMIC_RELAXED);
+}
+
+// Samples the heap footprint on the latency pass, where it is not timed.
+static void checkpoint(Run* run) {
+    if (!run->samples) return;
+    size_t footprint = allocator_footprint(run->allocator);
+    if (footprint > run->peak_footprint) {
+        run->peak_footprint = footprint;
+    }
+}
+
+/// ------------------------------- WORKLOADS ------------------------------- //
+
+static uint64_t next_random(uint64_t* state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+typedef size_t (*SizeMix)(uint64_t* rng);
+
+// 16 to 1024 bytes, all sizes equally likely.
+static size_t uniform_size(uint64_t* rng) {
+    return 16 + next_random(rng) % 1009;
+}
+
+// 16 bytes to 64 KiB with P(size > s) proportional to 1/s: mostly small
+// objects with a heavy tail of large ones.
+static size_t power_law_size(uint64_t* rng) {
+    return 65536 / (1 + next_random(rng) % 4096);
+}
+
+typedef enum FreeOrder { FREE_LIFO, FREE_FIFO, FREE_RANDOM } FreeOrder;
+
+// Allocates a batch, then frees all of it in the given order, for several rounds.
+static void batch_workload(Run* run, SizeMix mix, FreeOrder order) {
+    enum { BATCH = 8192, ROUNDS = 16 };
+    static void* ptrs[BATCH];
+    static size_t sizes[BATCH];
+    uint64_t rng = 0x9E3779B97F4A7C15ull;
+
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; i < BATCH; i++) {
+            sizes[i] = mix(&rng);
+            ptrs[i] = run_malloc(run, sizes[i]);
+        }
+        checkpoint(run);
+
+        if (order == FREE_RANDOM) {
+            for (int i = BATCH - 1; i > 0; i--) {
+                int j = (int)(next_random(&rng) % (uint64_t)(i + 1));
+                void* ptr = ptrs[i]; ptrs[i] = ptrs[j]; ptrs[j] = ptr;
+                size_t size = sizes[i]; sizes[i] = sizes[j]; sizes[j] = size;
+            }
+        }
+        for (int i = 0; i < BATCH; i++) {
+            int index = order == FREE_LIFO ? BATCH - 1 - i : i;
+            run_free(run, ptrs[index], sizes[index]);
+        }
+    }
+}
+
+static void uniform_lifo(Run* run) { batch_workload(run, uniform_size, FREE_LIFO); }
+static void uniform_fifo(Run* run) { batch_workload(run, uniform_size, FREE_FIFO); }
+static void uniform_random(Run* run) { batch_workload(run, uniform_size, FREE_RANDOM); }
+static void power_law_lifo(Run* run) { batch_workload(run, power_law_size, FREE_LIFO); }
+static void power_law_fifo(Run* run) { batch_workload(run, power_law_size, FREE_FIFO); }
+static void power_law_random(Run* run) { batch_workload(run, power_law_size, FREE_RANDOM); }
+
+// Growing buffers: each step picks a buffer and grows it by half until it
+// passes 64 KiB, then frees it and starts over.
+static void realloc_growth(Run* run) {
+    enum { BUFFERS = 256, STEPS = 200000, LIMIT = 64 * 1024 };
+    static void* ptrs[BUFFERS];
+    static size_t sizes[BUFFERS];
+    uint64_t rng = 0x2545F4914F6CDD1Dull;
+    memset(ptrs, 0, sizeof(ptrs));
+    memset(sizes, 0, sizeof(sizes));
+
+    for (int step = 0; step < STEPS; step++) {
+        int b = (int)(next_random(&rng) % BUFFERS);
+        if (sizes[b] >= LIMIT) {
+            run_free(run, ptrs[b], sizes[b]);
+            ptrs[b] = NULL;
+            sizes[b] = 0;
+        }
+        else {
+            size_t size = sizes[b] ? sizes[b] + sizes[b] / 2 : 16;
+            void* ptr = run_realloc(run, ptrs[b], sizes[b], size);
+            if (ptr) {
+                ptrs[b] = ptr;
+                sizes[b] = size;
+            }
+        }
+        if (step % 256 == 0) {
+            checkpoint(run);
+        }
+    }
+    for (int b = 0; b < BUFFERS; b++) {
+        run_free(run, ptrs[b], sizes[b]);
+    }
+}
+
+// A producer thread allocates messages and a consumer frees them, through a
+// single-producer single-consumer ring, so every block is freed by another thread.
+#define RING_SLOTS 1024
+#define MESSAGES 100000
+
+typedef struct Ring {
+    void* ptrs[RING_SLOTS];
+    size_t sizes[RING_SLOTS];
+    size_t head;                // next slot the producer fills
+    size_t tail;                // next slot the consumer drains
+    Run* run;
+} Ring;
+
+static void* producer_thread(void* arg) {
+    Ring* ring = (Ring*)arg;
+    uint64_t rng = 0xD1B54A32D192ED03ull;
+    for (size_t i = 0; i < MESSAGES; i++) {
+        while (i - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == RING_SLOTS) {
+            sched_yield();
+        }
+        size_t size = uniform_size(&rng);
+        ring->sizes[i % RING_SLOTS] = size;
+        ring->ptrs[i % RING_SLOTS] = run_malloc(ring->run, size);
+        __atomic_store_n(&ring->head, i + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+static void producer_consumer(Run* run) {
+    static Ring ring;
+    ring.head = ring.tail = 0;
+    ring.run = run;
+
+    pthread_t producer;
+    pthread_create(&producer, NULL, producer_thread, &ring);
+    for (size_t i = 0; i < MESSAGES; i++) {
+        while (__atomic_load_n(&ring.head, __ATOMIC_ACQUIRE) == i) {
+            sched_yield();
+        }
+        run_free(run, ring.ptrs[i % RING_SLOTS], ring.sizes[i % RING_SLOTS]);
+        __atomic_store_n(&ring.tail, i + 1, __ATOMIC_RELEASE);
+    }
+    pthread_join(producer, NULL);
+    checkpoint(run);
+}
+
+// Replays a trace written by magic_trace_start. Trace handles map to the
+// replayed blocks through an open addressing table keyed by handle.
+typedef struct Handle {
+    uint64_t id;                // 0 for an empty slot
+    int deleted;                // tombstone, keeps probe chains intact
+    void* ptr;
+    size_t size;
+} Handle;
+
+static const MagicTraceRecord* trace_records;
+static uint64_t trace_capacity, trace_first, trace_end;     // records [trace_first, trace_end) survive
+static Handle* handles;
+static size_t handle_mask;
+
+static Handle* handle_find(uint64_t id, int insert) {
+    size_t i = (size_t)((id * 0x9E3779B97F4A7C15ull) >> 32) & handle_mask;
+    Handle* tombstone = NULL;
+    for (;; i = (i + 1) & handle_mask) {
+        Handle* slot = &handles[i];
+        if (slot->id == id && !slot->deleted) return slot;
+        if (slot->deleted && !tombstone) tombstone = slot;
+        if (!slot->id && !slot->deleted) {
+            if (!insert) return NULL;
+            slot = tombstone ? tombstone : slot;
+            slot->id = id;
+            slot->deleted = 0;
+            return slot;
+        }
+    }
+}
+
+static void handle_remove(Handle* slot) {
+    slot->deleted = 1;
+    slot->ptr = NULL;
+}
+
+// Faults in the trace and clears the handle table before the resident
+// baseline is taken, so neither counts as heap footprint.
+static void replay_prepare() {
+    volatile uint64_t sum = 0;
+    for (uint64_t i = 0; i < trace_capacity; i += 4096 / sizeof(MagicTraceRecord)) {
+        sum += trace_records[i].timestamp;
+    }
+    memset(handles, 0, (handle_mask + 1) * sizeof(Handle));
+}
+
+static void replay_trace(Run* run) {
+    for (uint64_t i = trace_first; i < trace_end; i++) {
+        const MagicTraceRecord* record = &trace_records[i % trace_capacity];
+        size_t size = MAGIC_TRACE_SIZE(record);
+        int op = MAGIC_TRACE_OP(record);
+        Handle* old = op == MAGIC_TRACE_REALLOC && record->old_id ? handle_find(record->old_id, 0) : NULL;
+        Handle* slot;
+        void* ptr;
+
+        switch (op) {
+        case MAGIC_TRACE_MALLOC:
+        case MAGIC_TRACE_CALLOC:
+        case MAGIC_TRACE_MEMALIGN:
+            if (!record->id) break;             // failed in the traced program too
+            if (op == MAGIC_TRACE_MEMALIGN) ptr = run_memalign(run, (size_t)1 << record->old_id, size);
+            else if (op == MAGIC_TRACE_CALLOC) ptr = run_calloc(run, size);
+            else ptr = run_malloc(run, size);
+            slot = handle_find(record->id, 1);
+            slot->ptr = ptr;
+            slot->size = size;
+            break;
+        case MAGIC_TRACE_FREE:
+            old = handle_find(record->id, 0);
+            if (old) {
+                run_free(run, old->ptr, old->size);
+                handle_remove(old);
+            }
+            break;
+        case MAGIC_TRACE_REALLOC:
+            if (!size) {                        // realloc to 0 frees
+                if (old) {
+                    run_free(run, old->ptr, old->size);
+                    handle_remove(old);
+                }
+                break;
+            }
+            if (!record->id) break;
+            if (record->old_id && !old) break;  // resizes a block allocated before the trace window
+            ptr = run_realloc(run, old ? old->ptr : NULL, old ? old->size : 0, size);
+            if (!ptr) break;
+            if (old) handle_remove(old);
+            slot = handle_find(record->id, 1);
+            slot->ptr = ptr;
+            slot->size = size;
+            break;
+        }
+        if ((i - trace_first) % 256 == 0) {
+            checkpoint(run);
+        }
+    }
+
+    // Blocks still live at the end of the trace
+    for (size_t i = 0; i <= handle_mask; i++) {
+        if (handles[i].id && !handles[i].deleted) {
+            run_free(run, handles[i].ptr, handles[i].size);
+        }
+    }
+}
+
+// Maps a trace file read-only. Returns 0 on success.
+static int load_trace(const char* path) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(MagicTraceHeader)) {
+        printf("Error: Could not read trace file %s\n", path);
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    void* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        printf("Error: Could not map trace file %s\n", path);
+        return -1;
+    }
+
+    const MagicTraceHeader* header = (const MagicTraceHeader*)map;
+    if (header->magic != MAGIC_TRACE_MAGIC || header->capacity == 0 ||
+        (size_t)st.st_size < sizeof(MagicTraceHeader) + header->capacity * sizeof(MagicTraceRecord)) {
+        printf("Error: %s is not a trace file\n", path);
+        return -1;
+    }
+    trace_records = (const MagicTraceRecord*)(header + 1);
+    trace_capacity = header->capacity;
+    trace_end = header->next;
+    trace_first = trace_end > trace_capacity ? trace_end - trace_capacity : 0;
+
+    size_t slots = 2;
+    while (slots < 2 * (trace_end - trace_first)) slots *= 2;
+    handles = malloc(slots * sizeof(Handle));
+    if (!handles) return -1;
+    handle_mask = slots - 1;
+
+    printf("Replaying %llu of %llu traced calls from %s\n",
+           (unsigned long long)(trace_end - trace_first), (unsigned long long)trace_end, path);
+    return 0;
+}
+
+typedef struct Workload {
+    const char* name;
+    void (*run)(Run* run);
+    void (*prepare)();          // optional, runs before the allocator starts
+} Workload;
+
+static const Workload workloads[] = {
+    { "uniform-lifo", uniform_lifo, NULL },
+    { "uniform-fifo", uniform_fifo, NULL },
+    { "uniform-random", uniform_random, NULL },
+    { "powerlaw-lifo", power_law_lifo, NULL },
+    { "powerlaw-fifo", power_law_fifo, NULL },
+    { "powerlaw-random", power_law_random, NULL },
+    { "realloc-growth", realloc_growth, NULL },
+    { "producer-consumer", producer_consumer, NULL },
+};
+
+/// ------------------------------- REPORT ------------------------------- //
+
+typedef struct Result {
+    double mops;
+    uint64_t p50, p99, p999;    // ns
+    double fragmentation;       // percent of the peak footprint not holding live bytes
+    size_t peak_live;           // bytes
+    size_t peak_footprint;      // bytes
+    size_t failures;
+} Result;
+
+static int compare_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static uint64_t percentile(const uint64_t* sorted, size_t count, size_t per_mille) {
+    return count ? sorted[count * per_mille / 1000] : 0;
+}
+
+// Throughput pass: no per-call timing.
+static void throughput_pass(const Workload* workload, Allocator* allocator, Result* result) {
+    Run run = { .allocator = allocator };
+    if (workload->prepare) workload->prepare();
+    allocator_begin(allocator);
+    uint64_t start = now_ns();
+    workload->run(&run);
+    double seconds = (now_ns() - start) / 1e9;
+    allocator_end(allocator);
+    result->mops = run.ops / seconds / 1e6;
+}
+
+// Latency pass: times every call and samples the footprint in between.
+static void latency_pass(const Workload* workload, Allocator* allocator, Result* result) {
+    size_t bytes = sample_capacity * sizeof(uint64_t);
+    uint64_t* samples = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (samples == MAP_FAILED) return;
+    memset(samples, 0, bytes);                              // resident before the baseline is taken
+    Run run = { .allocator = allocator, .samples = samples };
+    if (workload->prepare) workload->prepare();
+    allocator_begin(allocator);
+    workload->run(&run);
+    checkpoint(&run);
+    allocator_end(allocator);
+
+    size_t count = run.ops < sample_capacity ? run.ops : sample_capacity;
+    qsort(samples, count, sizeof(uint64_t), compare_u64);
+    result->p50 = percentile(samples, count, 500);
+    result->p99 = percentile(samples, count, 990);
+    result->p999 = percentile(samples, count, 999);
+    result->fragmentation = run.peak_footprint > run.peak_live
+        ? 100.0 * (1.0 - (double)run.peak_live / run.peak_footprint) : 0.0;
+    result->peak_live = run.peak_live;
+    result->peak_footprint = run.peak_footprint;
+    result->failures = run.failures;
+    munmap(samples, bytes);
+}
+
+// Runs a pass in a child process, so every allocator starts from the same
+// untouched heap and resident set whatever ran before it. glibc never hands
+// all of its pages back, so this is the only fair baseline for it.
+static void isolated(void (*pass)(const Workload*, Allocator*, Result*),
+                     const Workload* workload, Allocator* allocator, Result* result) {
+    fflush(stdout);
+    pid_t child = fork();
+    if (child == 0) {
+        pass(workload, allocator, result);
+        _exit(0);
+    }
+    if (child < 0 || waitpid(child, NULL, 0) < 0) {
+        printf("Error: Could not run %s on %s\n", workload->name, allocator->name);
+    }
+}
+
+static void bench(const Workload* workload, Allocator* allocator, Result* result) {
+    memset(result, 0, sizeof(Result));
+    isolated(throughput_pass, workload, allocator, result);
+    isolated(latency_pass, workload, allocator, result);
+
+    printf("%-18s %-11s %8.2f %8llu %8llu %9llu %8.1f%% %10zu", workload->name, allocator->name,
+           result->mops,
+           (unsigned long long)result->p50,
+           (unsigned long long)result->p99,
+           (unsigned long long)result->p999,
+           result->fragmentation,
+           result->peak_footprint / 1024);
+    if (result->failures) {
+        printf("  (%zu failed)", result->failures);
+    }
+    printf("\n");
+}
+
+/// ------------------------------- SCALING ------------------------------- //
+
+// Every thread keeps a window of live blocks and replaces a random one per
+// step, on a sharded pool with a single shard (one lock for all threads),
+// one shard per thread, and one per CPU.
+#define SCALING_STEPS 200000
+#define SCALING_WINDOW 256
+#define SCALING_MAX_THREADS 8
+
+typedef struct ScalingThread {
+    MagicShardedPool* sharded;
+    uint64_t seed;
+} ScalingThread;
+
+static void* scaling_thread(void* arg) {
+    ScalingThread* thread = (ScalingThread*)arg;
+    void* window[SCALING_WINDOW] = { NULL };
+    uint64_t rng = thread->seed;
+    for (int step = 0; step < SCALING_STEPS; step++) {
+        size_t slot = next_random(&rng) % SCALING_WINDOW;
+        magic_sharded_pool_free(thread->sharded, window[slot]);
+        window[slot] = magic_sharded_pool_malloc(thread->sharded, uniform_size(&rng));
+    }
+    for (int slot = 0; slot < SCALING_WINDOW; slot++) {
+        magic_sharded_pool_free(thread->sharded, window[slot]);
+    }
+    return NULL;
+}
+
+// Returns the throughput of all threads together in Mops/s.
+static double scaling_pass(unsigned threads, unsigned shards, MagicShardPolicy policy) {
+    MagicShardedPool* sharded = magic_sharded_pool_create(POOL_BYTES, shards, policy);
+    if (!sharded) return 0.0;
+
+    pthread_t ids[SCALING_MAX_THREADS];
+    ScalingThread work[SCALING_MAX_THREADS];
+    uint64_t start = now_ns();
+    for (unsigned i = 0; i < threads; i++) {
+        work[i].sharded = sharded;
+        work[i].seed = 0x9E3779B97F4A7C15ull * (i + 1);
+        pthread_create(&ids[i], NULL, scaling_thread, &work[i]);
+    }
+    for (unsigned i = 0; i < threads; i++) {
+        pthread_join(ids[i], NULL);
+    }
+    double seconds = (now_ns() - start) / 1e9;
+    magic_sharded_pool_destroy(sharded);
+    return 2.0 * threads * SCALING_STEPS / seconds / 1e6;
+}
+
+// Prints the Mops/s of each configuration per thread count.
+static void scaling() {
+    printf("\n%-18s %-11s %10s %10s %10s\n", "sharded-scaling", "threads", "1 shard", "per thread", "per CPU");
+    for (unsigned threads = 1; threads <= SCALING_MAX_THREADS; threads *= 2) {
+        printf("%-18s %-11u %10.2f %10.2f %10.2f\n", "", threads,
+               scaling_pass(threads, 1, MAGIC_SHARD_THREAD),
+               scaling_pass(threads, threads, MAGIC_SHARD_THREAD),
+               scaling_pass(threads, 0, MAGIC_SHARD_CPU));
+    }
+}
+
+int main(int argc, char** argv)
+{
+    // Optional argument: run only workloads whose name contains it,
+    // or `--replay file` to replay a trace instead
+    const char* filter = argc > 1 ? argv[1] : NULL;
+    const Workload replay = { "replay", replay_trace, replay_prepare };
+    int replaying = filter && strcmp(filter, "--replay") == 0;
+    if (replaying) {
+        if (argc < 3 || load_trace(argv[2]) != 0) {
+            printf("Usage: %s --replay trace-file\n", argv[0]);
+            return 1;
+        }
+        if (trace_end - trace_first > sample_capacity) {
+            sample_capacity = trace_end - trace_first;
+        }
+    }
+
+    // Shared with the child processes that run the passes
+    Result* result = mmap(NULL, sizeof(Result), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (result == MAP_FAILED) return 1;
+
+    printf("%-18s %-11s %8s %8s %8s %9s %9s %10s\n",
+           "workload", "allocator", "Mops/s", "p50 ns", "p99 ns", "p99.9 ns", "peak frag", "peak KiB");
+    for (size_t a = 0; replaying && a < sizeof(allocators) / sizeof(allocators[0]); a++) {
+        bench(&replay, &allocators[a], result);
+    }
+    for (size_t w = 0; !replaying && w < sizeof(workloads) / sizeof(workloads[0]); w++) {
+        if (filter && !strstr(workloads[w].name, filter)) continue;
+        for (size_t a = 0; a < sizeof(allocators) / sizeof(allocators[0]); a++) {
+            bench(&workloads[w], &allocators[a], result);
+        }
+    }
+
+    if (!replaying && (!filter || strstr("sharded-scaling", filter))) {
+        scaling();
+    }
+
+    munmap(result, sizeof(Result));
+    return 0;
+}
@@ -1,260 +1,3538 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE             // mremap, sched_getcpu
+#endif
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include "main.h"
 #include <string.h>
+#include <errno.h>
 #include "test.h"
 #include <time.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#endif
 
-#define ALIGNMENT 8
+#define ALIGNMENT MAGIC_ALIGNMENT
 #define ALIGN(size) (((size) + (ALIGNMENT - 1)) & ~(ALIGNMENT - 1))  // Ensures size is a multiple of the alignment
+#define REQUEST_SIZE(size) (ALIGN(size) < MIN_PAYLOAD ? MIN_PAYLOAD : ALIGN(size))  // payload handed out for a request
+#define SET_SIZE(block, size) ((block)->header = (size) | ((block)->header & BLOCK_FLAGS))
+#define LINKS(block) ((FreeLinks*)((block) + 1))                                          // free list links of a free block
+#define FOOTER(block) (*(size_t*)((char*)(block) + BLOCK_SIZE + GET_SIZE(block) - sizeof(size_t)))  // boundary tag of a free block
+#define CACHE_NEXT(block) (*(Block**)((block) + 1))                                       // thread cache link of a cached block
+#define CACHE_TAG(block) (((size_t*)((block) + 1))[1])                                   // TCACHE_MARK while a block waits in a thread cache
+#define POOL_MAX_SIZE ((size_t)UINT32_MAX * ALIGNMENT)                                    // largest pool free list offsets can address
+#define POOL_GROW_STEP ((size_t)64 * 1024)                                                // growable pools commit memory in multiples of this
+#define OS_PAGE_SIZE ((size_t)4096)                                                       // mapping sizes are rounded to this
+#define PURGE_MIN_SIZE (2 * OS_PAGE_SIZE)                                                 // smallest free block whose pages are purged
+#define PURGE_STAMP(block) (*(uint64_t*)(LINKS(block) + 1))                               // decay epoch a large free block was filed in
+#define PURGED UINT64_MAX                                                                 // PURGE_STAMP of a block whose pages went back to the OS
+#define FAST_MARK 0xfa57b10cu                                                             // FreeLinks.prev of a block waiting in a fast bin
+#define TCACHE_MARK ((size_t)0x7cac4eb1u)                                                 // CACHE_TAG of a block waiting in a thread cache
+#define FLOOR_LOG2(x) (63 - __builtin_clzll((unsigned long long)(x)))
 
-char memory_pool[MEMORY_POOL_SIZE];          // Simulated Heap
-Block* free_list = (Block*)memory_pool;      // linked list to track free memory blocks
+#define TCACHE_MAX_SIZE 256                               // largest payload kept in thread caches
+#define TCACHE_CLASSES (TCACHE_MAX_SIZE / ALIGNMENT)
+#define TCACHE_LIMIT 64                                   // cached blocks per class before a flush
+#define TCACHE_BATCH 16                                   // blocks moved per refill or flush
+#define TCACHE_STATS_BATCH 64                             // cached calls counted per thread before publishing
+
+#define SMALL_BIN_COUNT 32                                // bins holding exactly one size each
+#define SMALL_BIN_LIMIT (SMALL_BIN_COUNT * ALIGNMENT)     // largest size with an exact bin
+
+#define LARGE_MAGIC 0x4b4c424c47414dull   // "MAGLBLK", opens every LargeBlock
+
+// Start of the mapping of a block above the pool's mmap threshold.
+typedef struct LargeBlock {
+    uint64_t magic;             // LARGE_MAGIC
+    struct LargeBlock* next;
+    struct LargeBlock* prev;
+    MagicPool* pool;
+    size_t mapping_size;
+} LargeBlock;
+
+#define LARGE_HEADER(large) ((Block*)((char*)(large) + ALIGN(sizeof(LargeBlock))))
+#define LARGE_OF(block) ((LargeBlock*)((char*)(block) - ALIGN(sizeof(LargeBlock))))
+#define LARGE_MAPPING_SIZE(size) ((ALIGN(sizeof(LargeBlock)) + BLOCK_SIZE + (size) + OS_PAGE_SIZE - 1) & ~(OS_PAGE_SIZE - 1))
+
+_Alignas(ALIGNMENT) char memory_pool[MEMORY_POOL_SIZE];          // Simulated Heap
+
+static MagicPool static_pool = { .lock = PTHREAD_MUTEX_INITIALIZER };  // pool over memory_pool, used by the magic_* functions
+static MagicPool* default_pool = NULL;       // pool the magic_* functions operate on
+
+static Block* pool_take_block(MagicPool* pool, size_t size);
+static Block* allocate_block(MagicPool* pool, Block* current, size_t size);
+static void pool_free(MagicPool* pool, void* ptr);
+static void* pool_malloc(MagicPool* pool, size_t size);
+static void pool_decay(MagicPool* pool);
+static void fast_consolidate(MagicPool* pool);
+static void persistent_close(MagicPool* pool);
+
+// Returns the size class of a payload size. Sizes up to SMALL_BIN_LIMIT get an
+// exact bin each; larger sizes share one bin per power of two.
+static int bin_index(size_t size) {
+    if (size <= SMALL_BIN_LIMIT) {
+        return (int)(size / ALIGNMENT) - 1;
+    }
+    int index = SMALL_BIN_COUNT + FLOOR_LOG2(size) - FLOOR_LOG2(SMALL_BIN_LIMIT);
+    return index < BIN_COUNT ? index : BIN_COUNT - 1;
+}
+
+// Free list links are stored as granule offsets from the pool base, plus one
+// so that 0 can stand for NULL.
+static uint32_t block_offset(MagicPool* pool, Block* block) {
+    return block ? (uint32_t)(((char*)block - pool->base) / ALIGNMENT) + 1 : 0;
+}
+
+static Block* offset_block(MagicPool* pool, uint32_t offset) {
+    return offset ? (Block*)(pool->base + (size_t)(offset - 1) * ALIGNMENT) : NULL;
+}
+
+// Whether a nonzero link leaves room for a free block's header and links
+// inside the heap. Checks test links with this before following them. The
+// smallest buddy blocks hold nothing more, so the bound is the same in every
+// mode.
+static int offset_in_heap(MagicPool* pool, uint32_t offset) {
+    return (size_t)(offset - 1) * ALIGNMENT + BLOCK_SIZE + sizeof(FreeLinks) <= pool->size;
+}
+
+// Returns the block physically after block, or NULL at the end of the pool.
+static Block* next_physical(MagicPool* pool, Block* block) {
+    Block* next = (Block*)((char*)block + BLOCK_SIZE + GET_SIZE(block));
+    return (char*)next < pool->base + pool->size ? next : NULL;
+}
+
+// Records in block's header whether its physical left neighbour is free.
+// Neighbours change this bit under the pool lock while the block's owner may
+// read its header without the lock (thread caches), so it is updated atomically.
+static void set_prev_free(Block* block, int prev_free) {
+    if (prev_free) {
+        __atomic_fetch_or(&block->header, (size_t)BLOCK_PREV_FREE, __ATOMIC_RELAXED);
+    }
+    else {
+        __atomic_fetch_and(&block->header, ~(size_t)BLOCK_PREV_FREE, __ATOMIC_RELAXED);
+    }
+}
+
+// Records in the header of block's right neighbour whether block is free. The
+// last block has no neighbour, so the pool keeps the bit for it instead.
+static void mark_next(MagicPool* pool, Block* block, int free) {
+    Block* next = next_physical(pool, block);
+    if (next) {
+        set_prev_free(next, free);
+    }
+    else {
+        pool->tail_free = free;
+    }
+}
+
+// Largest payload a pool can hold, counting the memory a growable pool may still add.
+static size_t pool_capacity(MagicPool* pool) {
+    return (pool->max_size ? pool->max_size : pool->size) - BLOCK_SIZE;
+}
+
+// Maps a payload size to its TLSF first-level (power of two) and second-level
+// (linear subdivision) class. Sizes below TLSF_SMALL_LIMIT all live in fl 0.
+static void tlsf_mapping(size_t size, int* fl, int* sl) {
+    if (size < TLSF_SMALL_LIMIT) {
+        *fl = 0;
+        *sl = (int)(size / ALIGNMENT);
+        return;
+    }
+    int log2 = FLOOR_LOG2(size);
+    *fl = log2 - FLOOR_LOG2(TLSF_SMALL_LIMIT) + 1;
+    *sl = (int)((size >> (log2 - TLSF_SL_LOG2)) ^ TLSF_SL_COUNT);
+    if (*fl >= TLSF_FL_COUNT) {
+        *fl = TLSF_FL_COUNT - 1;
+        *sl = TLSF_SL_COUNT - 1;
+    }
+}
+
+// Buddy blocks span a power of two bytes, header included; their order is that power.
+static int buddy_order(size_t size) {
+    return FLOOR_LOG2(size + BLOCK_SIZE);
+}
+
+// Returns the index in pool->bins of the list for a free block of this size.
+static int list_index(MagicPool* pool, size_t size) {
+    return pool->mode == MAGIC_MODE_BUDDY ? buddy_order(size) : bin_index(size);
+}
+
+// Returns the list head a free block of this size belongs to.
+static uint32_t* bin_head(MagicPool* pool, size_t size) {
+    if (pool->mode == MAGIC_MODE_TLSF) {
+        int fl, sl;
+        tlsf_mapping(size, &fl, &sl);
+        return &pool->tlsf->bins[fl][sl];
+    }
+    return &pool->bins[list_index(pool, size)];
+}
+
+// Sets or clears the bitmap bits that advertise the bin of this size.
+static void bin_mark(MagicPool* pool, size_t size, int non_empty) {
+    if (pool->mode == MAGIC_MODE_TLSF) {
+        int fl, sl;
+        tlsf_mapping(size, &fl, &sl);
+        if (non_empty) {
+            pool->tlsf->sl_bitmap[fl] |= 1u << sl;
+            pool->tlsf->fl_bitmap |= (uint64_t)1 << fl;
+        }
+        else {
+            pool->tlsf->sl_bitmap[fl] &= ~(1u << sl);
+            if (!pool->tlsf->sl_bitmap[fl]) {
+                pool->tlsf->fl_bitmap &= ~((uint64_t)1 << fl);
+            }
+        }
+        return;
+    }
+    int index = list_index(pool, size);
+    if (non_empty) {
+        pool->bin_bitmap |= (uint64_t)1 << index;
+    }
+    else {
+        pool->bin_bitmap &= ~((uint64_t)1 << index);
+    }
+}
+
+/// ------------------------------- BEST FIT TREE ------------------------------- //
+
+// MAGIC_FIT_BEST pools keep the free blocks above SMALL_BIN_LIMIT in a treap
+// ordered by (size, address) instead of the range bins, so the smallest block
+// that fits, lowest address first, is found in O(log n). A node's FreeLinks
+// hold its child offsets and its priority is a hash of its offset, so tree
+// nodes need no more room than any free block.
+
+#define TREE_LEFT(block) (LINKS(block)->next)
+#define TREE_RIGHT(block) (LINKS(block)->prev)
+#define IN_TREE(pool, size) ((pool)->fit == MAGIC_FIT_BEST && (size) > SMALL_BIN_LIMIT)
+
+static uint32_t tree_priority(uint32_t offset) {
+    return offset * 2654435761u;    // Knuth's multiplicative hash
+}
+
+static int tree_before(Block* a, Block* b) {
+    return GET_SIZE(a) < GET_SIZE(b) || (GET_SIZE(a) == GET_SIZE(b) && a < b);
+}
+
+// Inserts block below root and returns the subtree's new root, rotating the
+// block up while its priority beats its parent's.
+static uint32_t tree_insert(MagicPool* pool, uint32_t root, Block* block) {
+    if (!root) {
+        TREE_LEFT(block) = TREE_RIGHT(block) = 0;
+        return block_offset(pool, block);
+    }
+    Block* node = offset_block(pool, root);
+    if (tree_before(block, node)) {
+        uint32_t left = tree_insert(pool, TREE_LEFT(node), block);
+        TREE_LEFT(node) = left;
+        if (tree_priority(left) > tree_priority(root)) {
+            Block* child = offset_block(pool, left);
+            TREE_LEFT(node) = TREE_RIGHT(child);
+            TREE_RIGHT(child) = root;
+            return left;
+        }
+    }
+    else {
+        uint32_t right = tree_insert(pool, TREE_RIGHT(node), block);
+        TREE_RIGHT(node) = right;
+        if (tree_priority(right) > tree_priority(root)) {
+            Block* child = offset_block(pool, right);
+            TREE_RIGHT(node) = TREE_LEFT(child);
+            TREE_LEFT(child) = root;
+            return right;
+        }
+    }
+    return root;
+}
+
+// Joins two treaps whose keys all order left before right.
+static uint32_t tree_join(MagicPool* pool, uint32_t left, uint32_t right) {
+    if (!left || !right) return left ? left : right;
+    if (tree_priority(left) > tree_priority(right)) {
+        Block* node = offset_block(pool, left);
+        TREE_RIGHT(node) = tree_join(pool, TREE_RIGHT(node), right);
+        return left;
+    }
+    Block* node = offset_block(pool, right);
+    TREE_LEFT(node) = tree_join(pool, left, TREE_LEFT(node));
+    return right;
+}
+
+// Removes block, which must be in the tree at its current size.
+static uint32_t tree_remove(MagicPool* pool, uint32_t root, Block* block) {
+    Block* node = offset_block(pool, root);
+    if (node == block) {
+        return tree_join(pool, TREE_LEFT(node), TREE_RIGHT(node));
+    }
+    if (tree_before(block, node)) {
+        TREE_LEFT(node) = tree_remove(pool, TREE_LEFT(node), block);
+    }
+    else {
+        TREE_RIGHT(node) = tree_remove(pool, TREE_RIGHT(node), block);
+    }
+    return root;
+}
+
+// Returns the smallest block of at least size bytes, lowest address first.
+static Block* tree_find(MagicPool* pool, size_t size) {
+    Block* best = NULL;
+    Block* node = offset_block(pool, pool->tree);
+    while (node) {
+        if (GET_SIZE(node) >= size) {
+            best = node;
+            node = offset_block(pool, TREE_LEFT(node));
+        }
+        else {
+            node = offset_block(pool, TREE_RIGHT(node));
+        }
+    }
+    return best;
+}
+
+// Counts the nodes under root, whose keys must order after lo and before hi
+// (NULL for no bound). A link out of the heap, a node out of order or more
+// than limit nodes make the count exceed limit, so a damaged tree is never
+// followed out of the pool or round a cycle.
+static size_t tree_count(MagicPool* pool, uint32_t root, Block* lo, Block* hi, size_t limit) {
+    if (!root) return 0;
+    Block* node = offset_block(pool, root);
+    if (!limit || !offset_in_heap(pool, root) || !IS_FREE(node) ||
+        (lo && !tree_before(lo, node)) || (hi && !tree_before(node, hi))) {
+        return limit + 1;
+    }
+    size_t left = tree_count(pool, TREE_LEFT(node), lo, node, limit - 1);
+    if (left > limit - 1) return limit + 1;
+    return 1 + left + tree_count(pool, TREE_RIGHT(node), node, hi, limit - 1 - left);
+}
+
+// Returns how many whole pages of a free block can be handed back to the OS,
+// keeping its links, decay stamp and boundary tag, and where they start.
+static size_t purgeable_pages(Block* block, char** start) {
+    uintptr_t first = ((uintptr_t)(LINKS(block) + 1) + sizeof(uint64_t) + OS_PAGE_SIZE - 1) & ~(OS_PAGE_SIZE - 1);
+    uintptr_t end = ((uintptr_t)&FOOTER(block)) & ~(OS_PAGE_SIZE - 1);
+    *start = (char*)first;
+    return end > first ? (end - first) / OS_PAGE_SIZE : 0;
+}
+
+// Marks a block free and pushes it onto the head of the list for its size,
+// flagging the list non-empty in the bitmap. Large blocks are stamped with
+// the current decay epoch.
+static void list_push(MagicPool* pool, Block* block) {
+    size_t size = GET_SIZE(block);
+    block->header |= BLOCK_FREE;
+    pool->stats.free_bytes += size;
+    pool->stats.free_blocks++;
+    if (size >= PURGE_MIN_SIZE) {
+        PURGE_STAMP(block) = pool->purge_epoch;
+    }
+    if (IN_TREE(pool, size)) {
+        pool->tree = tree_insert(pool, pool->tree, block);
+        return;
+    }
+
+    uint32_t* head = bin_head(pool, size);
+    LINKS(block)->prev = 0;
+    LINKS(block)->next = *head;
+    if (*head) {
+        LINKS(offset_block(pool, *head))->prev = block_offset(pool, block);
+    }
+    else {
+        bin_mark(pool, size, 1);
+    }
+    *head = block_offset(pool, block);
+}
+
+// Unlinks a free block from its list, clearing the bitmap bit once the list is empty.
+static void list_unlink(MagicPool* pool, Block* block) {
+    FreeLinks* links = LINKS(block);
+    pool->stats.free_bytes -= GET_SIZE(block);
+    pool->stats.free_blocks--;
+    if (GET_SIZE(block) >= PURGE_MIN_SIZE && PURGE_STAMP(block) == PURGED) {
+        char* start;
+        pool->stats.purged_pages -= purgeable_pages(block, &start);
+    }
+    if (pool->rover == block_offset(pool, block)) {
+        pool->rover = 0;
+    }
+    if (IN_TREE(pool, GET_SIZE(block))) {
+        pool->tree = tree_remove(pool, pool->tree, block);
+        return;
+    }
+    if (links->prev) {
+        LINKS(offset_block(pool, links->prev))->next = links->next;
+    }
+    else {
+        *bin_head(pool, GET_SIZE(block)) = links->next;
+        if (!links->next) {
+            bin_mark(pool, GET_SIZE(block), 0);
+        }
+    }
+    if (links->next) {
+        LINKS(offset_block(pool, links->next))->prev = links->prev;
+    }
+}
+
+// Decay epoch a free block's pages have been unused since, for merging it
+// with other free memory; blocks too small to be purged count as new.
+static uint64_t free_stamp(MagicPool* pool, Block* block) {
+    return GET_SIZE(block) >= PURGE_MIN_SIZE ? PURGE_STAMP(block) : pool->purge_epoch;
+}
+
+// Gives a block just filed by list_push an older stamp, so carving from or
+// merging into a large free block does not restart its decay.
+static void inherit_stamp(MagicPool* pool, Block* block, uint64_t stamp) {
+    if (GET_SIZE(block) < PURGE_MIN_SIZE) return;
+    PURGE_STAMP(block) = stamp;
+    if (stamp == PURGED) {
+        char* start;
+        pool->stats.purged_pages += purgeable_pages(block, &start);
+    }
+}
+
+// Files a free block in the bin for its size. Also writes the block's
+// boundary tag and flags it in its right neighbour.
+static void bin_insert(MagicPool* pool, Block* block) {
+    FOOTER(block) = GET_SIZE(block);
+    mark_next(pool, block, 1);
+    list_push(pool, block);
+}
+
+static void bin_remove(MagicPool* pool, Block* block) {
+    list_unlink(pool, block);
+}
+
+/// ------------------------------- STATISTICS ------------------------------- //
+
+// Call counts are bumped with relaxed atomics because thread caches publish
+// theirs without the pool lock. Everything else changes under the lock.
+static void stats_count(size_t* counter, size_t n) {
+    __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+// Accounts for an allocated block entering (delta 1) or leaving (delta -1) use.
+// Every block handed out passes through here, so it also moves the pool's
+// fresh mark past blocks entering use.
+static void stats_use(MagicPool* pool, Block* block, int delta) {
+    MagicStats* stats = &pool->stats;
+    size_t size = GET_SIZE(block);
+    if (delta > 0) {
+        size_t end = (size_t)((char*)(block + 1) - pool->base) + size;
+        if (end > pool->fresh && !IS_MMAPPED(block)) {
+            pool->fresh = end;
+        }
+        stats->bytes_in_use += size;
+        stats->size_classes[bin_index(size)]++;
+        if (stats->bytes_in_use > stats->peak_bytes_in_use) {
+            stats->peak_bytes_in_use = stats->bytes_in_use;
+        }
+    }
+    else {
+        stats->bytes_in_use -= size;
+        stats->size_classes[bin_index(size)]--;
+    }
+}
+
+// Payload of the largest free block, read from the highest non-empty bin
+// without walking a list. Exact and buddy bins hold one size and the fit
+// tree is ordered, so the answer is exact there. A range bin is unordered;
+// its first block stands in for it, so a free block of at least the returned
+// size exists and the largest is less than twice as big (1/32 more for
+// TLSF bins).
+static size_t largest_free_block(MagicPool* pool) {
+    if (pool->tree) {
+        Block* node = offset_block(pool, pool->tree);
+        while (TREE_RIGHT(node)) {
+            node = offset_block(pool, TREE_RIGHT(node));
+        }
+        return GET_SIZE(node);
+    }
+
+    uint32_t head;
+    if (pool->mode == MAGIC_MODE_TLSF) {
+        TlsfIndex* tlsf = pool->tlsf;
+        if (!tlsf->fl_bitmap) return 0;
+        int fl = 63 - __builtin_clzll(tlsf->fl_bitmap);
+        head = tlsf->bins[fl][31 - __builtin_clz(tlsf->sl_bitmap[fl])];
+    }
+    else {
+        if (!pool->bin_bitmap) return 0;
+        head = pool->bins[63 - __builtin_clzll(pool->bin_bitmap)];
+    }
+    return GET_SIZE(offset_block(pool, head));
+}
+
+/// ------------------------------- BUDDY BACKEND ------------------------------- //
+
+// MAGIC_MODE_BUDDY pools hand out blocks of exactly 2^order bytes, header
+// included, each aligned to its size relative to the pool base. pool->bins[order]
+// lists the free blocks of that order and pool->bin_bitmap marks non-empty
+// orders, so a block's buddy is found by flipping one offset bit instead of
+// searching, and split and merge take O(log n) steps.
+
+#define BUDDY_BYTES(order) ((size_t)1 << (order))
+#define BUDDY_MIN_ORDER (FLOOR_LOG2(BLOCK_SIZE + sizeof(FreeLinks) - 1) + 1)  // header plus FreeLinks
+
+// Carves the region into the largest aligned power of two blocks that fit.
+// Any tail smaller than the minimum block is left out of the pool.
+static void buddy_init(MagicPool* pool) {
+    size_t offset = 0;
+    while (pool->size - offset >= BUDDY_BYTES(BUDDY_MIN_ORDER)) {
+        int order = FLOOR_LOG2(pool->size - offset);
+        if (offset && __builtin_ctzll(offset) < order) {
+            order = __builtin_ctzll(offset);
+        }
+        Block* block = (Block*)(pool->base + offset);
+        block->header = BUDDY_BYTES(order) - BLOCK_SIZE;
+        list_push(pool, block);
+        offset += BUDDY_BYTES(order);
+    }
+    pool->size = offset;
+}
+
+// Takes a block of the smallest order holding size bytes, splitting a larger
+// block in halves and filing every upper half as a free buddy.
+static Block* buddy_take(MagicPool* pool, size_t size) {
+    int order = FLOOR_LOG2(size + BLOCK_SIZE - 1) + 1;
+    if (order >= BIN_COUNT) return NULL;
+    uint64_t orders = pool->bin_bitmap & (~(uint64_t)0 << order);
+    if (!orders) return NULL;
+
+    int current = __builtin_ctzll(orders);
+    Block* block = offset_block(pool, pool->bins[current]);
+    list_unlink(pool, block);
+    while (current > order) {
+        current--;
+        Block* upper = (Block*)((char*)block + BUDDY_BYTES(current));
+        upper->header = BUDDY_BYTES(current) - BLOCK_SIZE;
+        list_push(pool, upper);
+    }
+    block->header = BUDDY_BYTES(order) - BLOCK_SIZE;
+    return block;
+}
+
+// Frees a block, merging it with its buddy for as long as the buddy is a
+// free block of the same order.
+static void buddy_free(MagicPool* pool, Block* block) {
+    int order = buddy_order(GET_SIZE(block));
+    size_t offset = (char*)block - pool->base;
+
+    while (order + 1 < BIN_COUNT) {
+        size_t buddy_offset = offset ^ BUDDY_BYTES(order);
+        if (buddy_offset + BUDDY_BYTES(order) > pool->size) break;
+        Block* buddy = (Block*)(pool->base + buddy_offset);
+        if (!IS_FREE(buddy) || GET_SIZE(buddy) != BUDDY_BYTES(order) - BLOCK_SIZE) break;
+
+        list_unlink(pool, buddy);
+        offset &= ~BUDDY_BYTES(order);
+        order++;
+    }
+
+    block = (Block*)(pool->base + offset);
+    block->header = BUDDY_BYTES(order) - BLOCK_SIZE;
+    list_push(pool, block);
+}
+
+// Halves an allocated block while the lower half still holds size bytes,
+// freeing each upper half.
+static void buddy_shrink(MagicPool* pool, Block* block, size_t size) {
+    int order = buddy_order(GET_SIZE(block));
+    while (order > BUDDY_MIN_ORDER && BUDDY_BYTES(order - 1) >= size + BLOCK_SIZE) {
+        order--;
+        Block* upper = (Block*)((char*)block + BUDDY_BYTES(order));
+        upper->header = BUDDY_BYTES(order) - BLOCK_SIZE;
+        list_push(pool, upper);
+    }
+    block->header = BUDDY_BYTES(order) - BLOCK_SIZE;
+}
+
+/// ------------------------------- CHECKS ------------------------------- //
+
+// How much validation runs is fixed at build time by MAGIC_CHECK_LEVEL (see
+// main.h). Release builds compile REPORT_ERROR and the pointer checks away.
+
+#define CHECKED (MAGIC_CHECK_LEVEL >= MAGIC_CHECK_CHECKED)
+#define DEBUG_CHECKS (MAGIC_CHECK_LEVEL >= MAGIC_CHECK_DEBUG)
+
+#if CHECKED
+static MagicErrorHandler error_handler;
+static __thread MagicError last_error;
+
+// Out of line and marked cold so a check costs the hot path one branch.
+__attribute__((cold, noinline))
+static void report_error(MagicPool* pool, MagicError error, void* ptr, size_t size) {
+    last_error = error;
+    if (error_handler) {
+        error_handler(pool, error, ptr, size);
+    }
+#if DEBUG_CHECKS
+    else {
+        printf("Error: %s (%p, %zu bytes)\n", magic_error_string(error), ptr, size);
+    }
+#endif
+}
+#define REPORT_ERROR(pool, error, ptr, size) report_error(pool, error, ptr, size)
+#else
+#define REPORT_ERROR(pool, error, ptr, size) ((void)0)
+#endif
+
+/**
+ * Installs the function called for every error the allocator detects, or
+ * NULL to only record errors for magic_last_error. Has no effect in release
+ * builds, which detect nothing.
+ */
+void magic_set_error_handler(MagicErrorHandler handler) {
+#if CHECKED
+    error_handler = handler;
+#else
+    (void)handler;
+#endif
+}
+
+/**
+ * Returns the last error detected on the calling thread. Like errno, it is
+ * not reset by calls that succeed.
+ */
+MagicError magic_last_error() {
+#if CHECKED
+    return last_error;
+#else
+    return MAGIC_OK;
+#endif
+}
+
+const char* magic_error_string(MagicError error) {
+    switch (error) {
+    case MAGIC_OK: return "No error";
+    case MAGIC_ERROR_INVALID_SIZE: return "Allocated invalid number of Bytes";
+    case MAGIC_ERROR_OUT_OF_MEMORY: return "No suitable free block found";
+    case MAGIC_ERROR_NULL_FREE: return "Attempted to free Null pointer";
+    case MAGIC_ERROR_DOUBLE_FREE: return "Memory Requested to free is already free";
+    case MAGIC_ERROR_INVALID_POINTER: return "Pointer is not an allocated block of this pool";
+    case MAGIC_ERROR_CORRUPTION: return "Heap is corrupted";
+    case MAGIC_ERROR_INVALID_ALIGNMENT: return "Alignment is not a supported power of two";
+    }
+    return "Unknown error";
+}
+
+#if CHECKED
+// Cheap validation of a pointer passed to free or realloc: it must be the
+// payload of a block inside the pool whose header fits the pool. The header
+// is read atomically since thread caches call this without the lock.
+static MagicError check_pointer(MagicPool* pool, void* ptr, int allow_free) {
+    char* payload = (char*)ptr;
+    if (payload < pool->base + BLOCK_SIZE || payload >= pool->base + pool->size ||
+        (size_t)(payload - pool->base) % ALIGNMENT != 0) {
+        return MAGIC_ERROR_INVALID_POINTER;
+    }
+    size_t header = __atomic_load_n(&((Block*)ptr - 1)->header, __ATOMIC_RELAXED);
+    if ((header & ~(size_t)BLOCK_FLAGS) > (size_t)(pool->base + pool->size - payload)) {
+        return MAGIC_ERROR_INVALID_POINTER;
+    }
+    if ((header & BLOCK_FREE) && !allow_free) {
+        return MAGIC_ERROR_DOUBLE_FREE;
+    }
+    return MAGIC_OK;
+}
+#endif
+
+// Counts the blocks on every free list, so lost or foreign list entries show
+// up. Links are bounds-checked and must point back at their predecessor, so a
+// damaged list counts as too long instead of being followed out of the heap.
+static size_t count_listed_blocks(MagicPool* pool) {
+    size_t limit = pool->stats.free_blocks;
+    size_t listed = tree_count(pool, pool->tree, NULL, NULL, limit);
+    uint32_t* heads = pool->mode == MAGIC_MODE_TLSF ? &pool->tlsf->bins[0][0] : pool->bins;
+    size_t lists = pool->mode == MAGIC_MODE_TLSF ? TLSF_FL_COUNT * TLSF_SL_COUNT : BIN_COUNT;
+    for (size_t i = 0; i < lists && listed <= limit; i++) {
+        uint32_t prev = 0;
+        for (uint32_t offset = heads[i]; offset; offset = LINKS(offset_block(pool, prev))->next) {
+            Block* block = offset_block(pool, offset);
+            if (!offset_in_heap(pool, offset) || !IS_FREE(block) || LINKS(block)->prev != prev || ++listed > limit) {
+                return limit + 1;
+            }
+            prev = offset;
+        }
+    }
+    return listed;
+}
+
+// Walks the whole heap with the lock held. Block sizes must tile the pool
+// exactly, boundary tags and PREV_FREE bits must match the free blocks, no two
+// free neighbours may be left unmerged (buddy blocks must be aligned powers of
+// two instead), and the free lists and statistics must agree with the blocks.
+static MagicError pool_check(MagicPool* pool) {
+    size_t free_bytes = 0, free_blocks = 0;
+    int prev_free = 0;
+    if (pool->fresh > pool->size) return MAGIC_ERROR_CORRUPTION;
+    Block* block = (Block*)pool->base;
+    while ((char*)block < pool->base + pool->size) {
+        size_t size = GET_SIZE(block);
+        size_t left = (size_t)(pool->base + pool->size - (char*)block) - BLOCK_SIZE;
+        if (size > left || size % ALIGNMENT != 0 || IS_MMAPPED(block)) return MAGIC_ERROR_CORRUPTION;
+
+        if (pool->mode == MAGIC_MODE_BUDDY) {
+            size_t span = size + BLOCK_SIZE;
+            if ((span & (span - 1)) || (size_t)((char*)block - pool->base) % span) return MAGIC_ERROR_CORRUPTION;
+        }
+        else {
+            if (PREV_IS_FREE(block) != prev_free) return MAGIC_ERROR_CORRUPTION;
+            if (IS_FREE(block) && (prev_free || FOOTER(block) != size)) return MAGIC_ERROR_CORRUPTION;
+            prev_free = IS_FREE(block);
+        }
+        if (IS_FREE(block)) {
+            free_bytes += size;
+            free_blocks++;
+        }
+        block = (Block*)((char*)block + BLOCK_SIZE + size);
+    }
+
+    if (free_bytes != pool->stats.free_bytes || free_blocks != pool->stats.free_blocks ||
+        count_listed_blocks(pool) != free_blocks) {
+        return MAGIC_ERROR_CORRUPTION;
+    }
+
+    size_t mapped_bytes = 0;
+    for (LargeBlock* large = pool->large; large; large = large->next) {
+        if (large->magic != LARGE_MAGIC || large->pool != pool || !IS_MMAPPED(LARGE_HEADER(large)) ||
+            (large->next && large->next->prev != large)) {
+            return MAGIC_ERROR_CORRUPTION;
+        }
+        mapped_bytes += large->mapping_size;
+    }
+    if (mapped_bytes != pool->stats.mapped_bytes) return MAGIC_ERROR_CORRUPTION;
+
+    // Non-empty bins and bitmap bits match, as searches trust the bitmap
+    for (int i = 0; pool->mode == MAGIC_MODE_SEGREGATED && i < BIN_COUNT; i++) {
+        if (!pool->bins[i] != !(pool->bin_bitmap & ((uint64_t)1 << i))) return MAGIC_ERROR_CORRUPTION;
+    }
+
+    // Fast blocks look allocated and sit in the bin of their exact size
+    size_t fast_count = 0;
+    for (int c = 0; pool->fast && c < FAST_BIN_COUNT; c++) {
+        for (uint32_t offset = pool->fast[c]; offset; offset = LINKS(offset_block(pool, offset))->next) {
+            Block* fast = offset_block(pool, offset);
+            if (!offset_in_heap(pool, offset) || IS_FREE(fast) || LINKS(fast)->prev != FAST_MARK ||
+                GET_SIZE(fast) != (size_t)(c + 1) * ALIGNMENT || ++fast_count > pool->fast_count) {
+                return MAGIC_ERROR_CORRUPTION;
+            }
+        }
+    }
+    if (fast_count != pool->fast_count) return MAGIC_ERROR_CORRUPTION;
+    return MAGIC_OK;
+}
+
+/**
+ * Validates every block and free list of a pool; debug builds do this after
+ * every locked operation. Returns MAGIC_ERROR_CORRUPTION, after reporting it,
+ * if an invariant is broken.
+ */
+MagicError magic_pool_check(MagicPool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    MagicError error = pool_check(pool);
+    pthread_mutex_unlock(&pool->lock);
+    if (error) {
+        REPORT_ERROR(pool, error, NULL, 0);
+    }
+    return error;
+}
+
+// Debug builds validate the heap at the end of every locked operation.
+#if DEBUG_CHECKS
+#define DEBUG_CHECK(pool) do { if (pool_check(pool)) REPORT_ERROR(pool, MAGIC_ERROR_CORRUPTION, NULL, 0); } while (0)
+#else
+#define DEBUG_CHECK(pool) ((void)0)
+#endif
+
+/// ------------------------------- THREAD CACHES ------------------------------- //
+
+// Each thread keeps LIFO stacks of recently freed small blocks for one pool.
+// Cached blocks stay allocated as far as the pool is concerned and their
+// headers are never written without the pool lock (neighbours read them while
+// coalescing), so the common malloc/free pair never touches shared state.
+// The cache links blocks through the first word of their payload and marks
+// them with TCACHE_MARK in the second, so checked builds can spot a block
+// freed twice into the calling thread's cache.
+// Blocks move between a cache and its pool TCACHE_BATCH at a time under a
+// single lock acquisition.
+typedef struct ThreadCache {
+    MagicPool* pool;                            // pool every cached block belongs to
+    Block* heads[TCACHE_CLASSES];               // class c holds blocks of (c + 1) * ALIGNMENT bytes
+    int counts[TCACHE_CLASSES];
+    size_t allocations;                         // calls served from the cache, not yet in pool->stats
+    size_t frees;
+} ThreadCache;
+
+static __thread ThreadCache thread_cache;
+static pthread_key_t thread_cache_key;          // only used to flush caches of exiting threads
+static pthread_once_t thread_cache_once = PTHREAD_ONCE_INIT;
+
+// Returns up to count blocks of class c to the pool.
+static void thread_cache_flush_class(ThreadCache* cache, int c, int count) {
+    MagicPool* pool = cache->pool;
+    pthread_mutex_lock(&pool->lock);
+    while (count-- > 0 && cache->heads[c]) {
+        Block* block = cache->heads[c];
+        cache->heads[c] = CACHE_NEXT(block);
+        cache->counts[c]--;
+        CACHE_TAG(block) = 0;
+        pool_free(pool, block + 1);
+    }
+    pool_decay(pool);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Adds the calls this cache served to its pool's counters.
+static void thread_cache_publish(ThreadCache* cache) {
+    stats_count(&cache->pool->stats.allocations, cache->allocations);
+    stats_count(&cache->pool->stats.frees, cache->frees);
+    cache->allocations = cache->frees = 0;
+}
+
+static void thread_cache_flush_all(ThreadCache* cache) {
+    thread_cache_publish(cache);
+    for (int c = 0; c < TCACHE_CLASSES; c++) {
+        if (cache->heads[c]) {
+            thread_cache_flush_class(cache, c, cache->counts[c]);
+        }
+    }
+    cache->pool = NULL;
+}
+
+static void thread_cache_exit(void* cache) {
+    if (((ThreadCache*)cache)->pool) {
+        thread_cache_flush_all((ThreadCache*)cache);
+    }
+}
+
+static void thread_cache_create_key() {
+    pthread_key_create(&thread_cache_key, thread_cache_exit);
+}
+
+// Returns the calling thread's cache, rebinding it to pool if it served another one.
+static ThreadCache* thread_cache_for(MagicPool* pool) {
+    ThreadCache* cache = &thread_cache;
+    if (cache->pool != pool) {
+        if (cache->pool) {
+            thread_cache_flush_all(cache);
+        }
+        else {
+            // Bound first: as the process allocator (libmagic.so) the cache
+            // may be reentered by allocations inside pthread_setspecific
+            cache->pool = pool;
+            pthread_once(&thread_cache_once, thread_cache_create_key);
+            pthread_setspecific(thread_cache_key, cache);
+        }
+        cache->pool = pool;
+    }
+    return cache;
+}
+
+// Pops a cached block of exactly size bytes, refilling the class from the pool
+// in one batch when it is empty. Returns NULL if the pool is out of memory.
+static Block* thread_cache_get(MagicPool* pool, size_t size) {
+    ThreadCache* cache = thread_cache_for(pool);
+    int c = (int)(size / ALIGNMENT) - 1;
+
+    if (!cache->heads[c]) {
+        pthread_mutex_lock(&pool->lock);
+        for (int i = 0; i < TCACHE_BATCH; i++) {
+            Block* block = pool_take_block(pool, size);
+            if (!block) break;
+            CACHE_NEXT(block) = cache->heads[c];
+            CACHE_TAG(block) = TCACHE_MARK;
+            cache->heads[c] = block;
+            cache->counts[c]++;
+        }
+        pthread_mutex_unlock(&pool->lock);
+        if (!cache->heads[c]) return NULL;
+    }
+
+    Block* block = cache->heads[c];
+    cache->heads[c] = CACHE_NEXT(block);
+    CACHE_TAG(block) = 0;
+    cache->counts[c]--;
+    if (++cache->allocations >= TCACHE_STATS_BATCH) {
+        thread_cache_publish(cache);
+    }
+    return block;
+}
+
+// Pushes a small allocated block onto the calling thread's cache, flushing a
+// batch back to the pool once the class is full. Returns 0 if the block is
+// not cacheable and must be freed through the pool. Checked builds report a
+// block this cache holds already as a double free.
+static int thread_cache_put(MagicPool* pool, Block* block) {
+    size_t header = __atomic_load_n(&block->header, __ATOMIC_RELAXED);
+    size_t size = header & ~(size_t)BLOCK_FLAGS;
+    if ((header & BLOCK_FREE) || size > TCACHE_MAX_SIZE) return 0;
+
+    ThreadCache* cache = thread_cache_for(pool);
+    int c = (int)(size / ALIGNMENT) - 1;
+#if CHECKED
+    // Only marked blocks are looked for, and a class holds under TCACHE_LIMIT
+    if (CACHE_TAG(block) == TCACHE_MARK) {
+        for (Block* cached = cache->heads[c]; cached; cached = CACHE_NEXT(cached)) {
+            if (cached == block) {
+                REPORT_ERROR(pool, MAGIC_ERROR_DOUBLE_FREE, block + 1, 0);
+                return 1;
+            }
+        }
+    }
+#endif
+    CACHE_NEXT(block) = cache->heads[c];
+    CACHE_TAG(block) = TCACHE_MARK;
+    cache->heads[c] = block;
+    if (++cache->frees >= TCACHE_STATS_BATCH) {
+        thread_cache_publish(cache);
+    }
+    if (++cache->counts[c] >= TCACHE_LIMIT) {
+        thread_cache_flush_class(cache, c, TCACHE_BATCH);
+    }
+    return 1;
+}
+
+/**
+ * Turns per-thread caching of small blocks on or off for a pool. While it is
+ * on, magic_pool_free keeps small blocks in the freeing thread's cache, so
+ * they are not coalesced until the cache flushes them.
+ */
+void magic_pool_set_thread_cache(MagicPool* pool, int enabled) {
+    if (!enabled && thread_cache.pool == pool) {
+        magic_thread_cache_flush();
+    }
+    pool->thread_cache = enabled;
+}
+
+/**
+ * Returns every block cached by the calling thread to its pool. Threads
+ * flush automatically when they exit; a pool must not be destroyed while
+ * another thread still caches blocks from it.
+ */
+void magic_thread_cache_flush() {
+    if (thread_cache.pool) {
+        thread_cache_flush_all(&thread_cache);
+    }
+}
+
+// Lays out a single free block spanning the whole region.
+static void pool_init(MagicPool* pool, char* base, size_t size, size_t mapping_size, MagicPoolMode mode) {
+    pool->base = base;
+    pool->size = size;
+    pool->mapping_size = mapping_size;
+    pool->mode = mode;
+    pool->bin_bitmap = 0;
+    pool->tail_free = 0;
+    pool->tree = 0;
+    pool->rover = 0;
+    pool->large = NULL;
+    pool->purge_epoch = 0;
+    memset(pool->bins, 0, sizeof(pool->bins));
+    pool->fast = NULL;
+    pool->fast_count = 0;
+    pool->root = 0;
+    pool->file = NULL;
+    pool->file_fd = -1;
+    pool->fresh = mapping_size ? 0 : size;     // only OS memory starts out zero
+    memset(&pool->stats, 0, sizeof(pool->stats));
+    if (pool->tlsf) {
+        memset(pool->tlsf, 0, sizeof(TlsfIndex));
+    }
+    if (mode == MAGIC_MODE_BUDDY) {
+        buddy_init(pool);
+        pool->fresh = pool->size;   // splits write headers all over the heap
+        return;
+    }
+
+    Block* first = (Block*)base;
+    first->header = size - BLOCK_SIZE;
+    bin_insert(pool, first);
+}
 
 // Initializing the first block of metaData. 
 void initialize_memory_pool() {
-    free_list = (Block*)memory_pool; // free_list points to the start of the memory pool
-    free_list->size = MEMORY_POOL_SIZE - BLOCK_SIZE;    
-    free_list->next = NULL;                              
-    free_list->free = 1;                                
-}
-int coalesce_right(Block* next_free, Block* block) {
-    if ((Block*)((char*)block + BLOCK_SIZE + block->size) == next_free) {
-        block->size += BLOCK_SIZE + next_free->size;
-        block->next = next_free->next;
+    pool_init(&static_pool, memory_pool, MEMORY_POOL_SIZE, 0, MAGIC_MODE_SEGREGATED);
+    default_pool = &static_pool;
+}
+
+MagicPool* magic_default_pool() {
+    if (!default_pool) {
+        initialize_memory_pool();
+    }
+    return default_pool;
+}
+
+/**
+ * Routes the magic_* functions to another pool, e.g. one created with
+ * magic_pool_create. Passing NULL restores the static memory_pool.
+ */
+void magic_set_default_pool(MagicPool* pool) {
+    if (!pool) {
+        pool = &static_pool;
+        if (!static_pool.base) {
+            initialize_memory_pool();
+        }
+    }
+    default_pool = pool;
+}
+
+static void* os_reserve(size_t size) {
+#ifdef _WIN32
+    return VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+    void* region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return region == MAP_FAILED ? NULL : region;
+#endif
+}
+
+// Reserves address space without backing it; os_commit makes page-aligned
+// ranges of it usable.
+static void* os_reserve_address_space(size_t size) {
+#ifdef _WIN32
+    return VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS);
+#else
+    void* region = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return region == MAP_FAILED ? NULL : region;
+#endif
+}
+
+static int os_commit(void* start, size_t size) {
+#ifdef _WIN32
+    return VirtualAlloc(start, size, MEM_COMMIT, PAGE_READWRITE) != NULL;
+#else
+    return mprotect(start, size, PROT_READ | PROT_WRITE) == 0;
+#endif
+}
+
+// Lets the OS reclaim the pages of a range whose contents are no longer
+// needed. The range stays mapped and reads back as zeros.
+static void os_purge(void* start, size_t size) {
+#ifdef _WIN32
+    VirtualAlloc(start, size, MEM_RESET, PAGE_READWRITE);
+#else
+    madvise(start, size, MADV_DONTNEED);
+#endif
+}
+
+#if CHECKED
+// Whether the page at start is mapped readable, so a pointer from the caller
+// can be looked at without faulting.
+static int os_mapped(void* start) {
+#ifdef _WIN32
+    MEMORY_BASIC_INFORMATION info;
+    return VirtualQuery(start, &info, sizeof(info)) && info.State == MEM_COMMIT && (info.Protect & PAGE_READWRITE);
+#else
+    unsigned char resident;
+    return mincore(start, OS_PAGE_SIZE, &resident) == 0;
+#endif
+}
+#endif
+
+static void os_release(void* region, size_t size) {
+#ifdef _WIN32
+    (void)size;
+    VirtualFree(region, 0, MEM_RELEASE);
+#else
+    munmap(region, size);
+#endif
+}
+
+/// ------------------------------- LARGE BLOCKS ------------------------------- //
+
+// Requests of at least pool->mmap_threshold bytes bypass the free index and
+// get a mapping of their own, so large buffers never split or pin the pool's
+// free blocks and their memory goes back to the OS as soon as they are freed
+// or shrunk. A mapping starts with a LargeBlock, linking it into the pool's
+// list (see the top of the file), followed by an ordinary header flagged
+// BLOCK_MMAPPED and the payload, which takes the rest of the mapping.
+
+// Whether ptr is to be freed as a large block. Checked builds decide by the
+// address alone so foreign pointers are never read, and large_free then
+// looks them up in the pool's list.
+#if CHECKED
+#define IS_LARGE(pool, ptr) ((char*)(ptr) < (pool)->base || (char*)(ptr) >= (pool)->base + (pool)->size)
+#else
+#define IS_LARGE(pool, ptr) IS_MMAPPED((Block*)(ptr) - 1)
+#endif
+
+// Resizes a mapping made by os_reserve. Without mremap the data is copied.
+static void* os_remap(void* region, size_t old_size, size_t new_size) {
+#ifdef __linux__
+    void* moved = mremap(region, old_size, new_size, MREMAP_MAYMOVE);
+    return moved == MAP_FAILED ? NULL : moved;
+#else
+    void* moved = os_reserve(new_size);
+    if (moved) {
+        memcpy(moved, region, old_size < new_size ? old_size : new_size);
+        os_release(region, old_size);
+    }
+    return moved;
+#endif
+}
+
+// Adds a large block to the pool's list and counts it as in use.
+static void large_link(MagicPool* pool, LargeBlock* large) {
+    large->prev = NULL;
+    large->next = pool->large;
+    if (pool->large) {
+        pool->large->prev = large;
+    }
+    pool->large = large;
+    pool->stats.mapped_bytes += large->mapping_size;
+    stats_use(pool, LARGE_HEADER(large), 1);
+}
+
+static void large_unlink(MagicPool* pool, LargeBlock* large) {
+    if (large->prev) {
+        large->prev->next = large->next;
+    }
+    else {
+        pool->large = large->next;
+    }
+    if (large->next) {
+        large->next->prev = large->prev;
+    }
+    pool->stats.mapped_bytes -= large->mapping_size;
+    stats_use(pool, LARGE_HEADER(large), -1);
+}
+
+// Returns the large block holding ptr, or NULL (and reports the error) if
+// the pool has none. Checked builds accept a pointer whose mapping is mapped
+// and opens with a LargeBlock of this pool, which costs a system call but no
+// list walk; an unmapped one, such as a large block freed before, is
+// reported. Debug builds also look the block up in the pool's list.
+static LargeBlock* large_find(MagicPool* pool, void* ptr) {
+    LargeBlock* large = LARGE_OF((Block*)ptr - 1);
+#if CHECKED
+    char* reserved_end = pool->base + (pool->max_size ? pool->max_size : pool->size);
+    int valid = (uintptr_t)large % OS_PAGE_SIZE == 0 && ((char*)large < pool->base || (char*)large >= reserved_end) &&
+                os_mapped(large) && large->magic == LARGE_MAGIC && large->pool == pool && IS_MMAPPED(LARGE_HEADER(large));
+#if DEBUG_CHECKS
+    LargeBlock* listed = pool->large;
+    while (listed && listed != large) {
+        listed = listed->next;
+    }
+    valid = valid && listed;
+#endif
+    if (!valid) {
+        REPORT_ERROR(pool, MAGIC_ERROR_INVALID_POINTER, ptr, 0);
+        return NULL;
+    }
+#else
+    (void)pool;
+#endif
+    return large;
+}
+
+// Maps a block for a request of size bytes; the mapping is made outside the pool lock.
+static void* large_malloc(MagicPool* pool, size_t size) {
+    size_t mapping_size = LARGE_MAPPING_SIZE(size);
+    LargeBlock* large = mapping_size > size ? os_reserve(mapping_size) : NULL;
+    if (!large) {
+        stats_count(&pool->stats.failed_allocations, 1);
+        REPORT_ERROR(pool, MAGIC_ERROR_OUT_OF_MEMORY, NULL, size);
+        return NULL;
+    }
+    large->magic = LARGE_MAGIC;
+    large->pool = pool;
+    large->mapping_size = mapping_size;
+    Block* block = LARGE_HEADER(large);
+    block->header = (mapping_size - ALIGN(sizeof(LargeBlock)) - BLOCK_SIZE) | BLOCK_MMAPPED;
+
+    pthread_mutex_lock(&pool->lock);
+    large_link(pool, large);
+    pthread_mutex_unlock(&pool->lock);
+    return block + 1;
+}
+
+static void large_free(MagicPool* pool, void* ptr) {
+    pthread_mutex_lock(&pool->lock);
+    LargeBlock* large = large_find(pool, ptr);
+    if (large) {
+        large_unlink(pool, large);
+        stats_count(&pool->stats.frees, 1);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    if (large) {
+        os_release(large, large->mapping_size);
+    }
+}
+
+// Resizes a large block with mremap, so its data is never copied, or moves
+// it back into the pool once it shrinks below the threshold.
+static void* large_realloc(MagicPool* pool, void* ptr, size_t new_size) {
+    if (new_size == 0) {
+        large_free(pool, ptr);
+        return NULL;
+    }
+    pthread_mutex_lock(&pool->lock);
+    LargeBlock* large = large_find(pool, ptr);
+    if (!large) {
+        pthread_mutex_unlock(&pool->lock);
+        return NULL;
+    }
+    stats_count(&pool->stats.reallocs, 1);
+
+    if (new_size < pool->mmap_threshold) {
+        void* new_ptr = pool_malloc(pool, new_size);
+        if (new_ptr) {
+            large_unlink(pool, large);
+            pthread_mutex_unlock(&pool->lock);
+            size_t old_size = GET_SIZE(LARGE_HEADER(large));
+            memcpy(new_ptr, ptr, new_size < old_size ? new_size : old_size);
+            os_release(large, large->mapping_size);
+            return new_ptr;
+        }
+    }
+
+    size_t mapping_size = LARGE_MAPPING_SIZE(new_size);
+    if (mapping_size == large->mapping_size) {
+        pthread_mutex_unlock(&pool->lock);
+        return ptr;
+    }
+    large_unlink(pool, large);
+    LargeBlock* moved = mapping_size > new_size ? os_remap(large, large->mapping_size, mapping_size) : NULL;
+    if (moved) {
+        moved->mapping_size = mapping_size;
+        LARGE_HEADER(moved)->header = (mapping_size - ALIGN(sizeof(LargeBlock)) - BLOCK_SIZE) | BLOCK_MMAPPED;
+        large = moved;
+    }
+    else {
+        REPORT_ERROR(pool, MAGIC_ERROR_OUT_OF_MEMORY, ptr, new_size);
+    }
+    large_link(pool, large);
+    pthread_mutex_unlock(&pool->lock);
+    return moved ? LARGE_HEADER(moved) + 1 : NULL;
+}
+
+/**
+ * Serves requests of at least threshold bytes from mappings of their own
+ * rather than the pool's free blocks; 0 turns this off (the default).
+ * Large blocks are freed and resized through the pool like any other.
+ * Persistent pools ignore the threshold.
+ */
+void magic_pool_set_mmap_threshold(MagicPool* pool, size_t threshold) {
+    if (pool->file) return;     // mappings of their own would not outlive the process
+    pool->mmap_threshold = threshold;
+}
+
+/**
+ * Chooses which of the free blocks that fit a segregated pool hands out;
+ * existing free blocks are reindexed. Returns -1, changing nothing, for TLSF
+ * and buddy pools, whose index fixes the placement.
+ */
+int magic_pool_set_fit(MagicPool* pool, MagicFitPolicy fit) {
+    if (pool->mode != MAGIC_MODE_SEGREGATED) return -1;
+
+    // Large free blocks move between the range bins and the tree
+    pthread_mutex_lock(&pool->lock);
+    for (Block* block = (Block*)pool->base; block; block = next_physical(pool, block)) {
+        if (IS_FREE(block) && GET_SIZE(block) > SMALL_BIN_LIMIT) list_unlink(pool, block);
+    }
+    pool->fit = fit;
+    for (Block* block = (Block*)pool->base; block; block = next_physical(pool, block)) {
+        if (IS_FREE(block) && GET_SIZE(block) > SMALL_BIN_LIMIT) {
+            uint64_t stamp = free_stamp(pool, block);     // list_push restamps, keep its age and purged pages
+            list_push(pool, block);
+            inherit_stamp(pool, block, stamp);
+        }
+    }
+    DEBUG_CHECK(pool);
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+/**
+ * Returns 1 if ptr is a block of pool: inside its region, or a large block
+ * mapped for it. Reads the page ptr points into.
+ */
+int magic_pool_owns(MagicPool* pool, void* ptr) {
+    char* payload = (char*)ptr;
+    if (payload >= pool->base && payload < pool->base + pool->size) return 1;
+
+    LargeBlock* large = LARGE_OF((Block*)ptr - 1);
+    return ((uintptr_t)large % OS_PAGE_SIZE) == 0 && large->pool == pool && IS_MMAPPED((Block*)ptr - 1);
+}
+
+/// ------------------------------- PURGING ------------------------------- //
+
+// Free blocks of OS-backed pools give the whole pages inside them back to
+// the OS once they have gone unused for a while, so a service's RSS falls
+// after its peak. Time is split into decay epochs of purge_decay_ms; every
+// large free block is stamped with the epoch it was filed in, and when an
+// epoch ends the blocks filed before it, which have been free for at least
+// one full epoch, are purged. Epochs end during free calls, so an idle
+// process purges on magic_trim.
+
+static uint64_t now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+static size_t purge_block(Block* block, uint64_t before) {
+    if (GET_SIZE(block) < PURGE_MIN_SIZE || PURGE_STAMP(block) >= before) return 0;
+    char* start;
+    size_t pages = purgeable_pages(block, &start);
+    if (pages) {
+        os_purge(start, pages * OS_PAGE_SIZE);
+    }
+    PURGE_STAMP(block) = PURGED;
+    return pages;
+}
+
+static size_t purge_list(MagicPool* pool, uint32_t head, uint64_t before) {
+    size_t purged = 0;
+    for (Block* block = offset_block(pool, head); block; block = offset_block(pool, LINKS(block)->next)) {
+        purged += purge_block(block, before);
+    }
+    return purged;
+}
+
+static size_t purge_tree(MagicPool* pool, uint32_t root, uint64_t before) {
+    if (!root) return 0;
+    Block* node = offset_block(pool, root);
+    return purge_block(node, before) + purge_tree(pool, TREE_LEFT(node), before) + purge_tree(pool, TREE_RIGHT(node), before);
+}
+
+// Purges the free blocks filed before epoch `before` that are not purged
+// yet and returns the number of pages released. Only the lists that can
+// hold blocks of PURGE_MIN_SIZE are visited.
+static size_t pool_purge(MagicPool* pool, uint64_t before) {
+    if (!pool->mapping_size) return 0;     // caller-owned memory is left alone
+
+    size_t purged = 0;
+    if (pool->mode == MAGIC_MODE_TLSF) {
+        int first, sl;
+        tlsf_mapping(PURGE_MIN_SIZE, &first, &sl);
+        for (int fl = first; fl < TLSF_FL_COUNT; fl++) {
+            if (!pool->tlsf->sl_bitmap[fl]) continue;
+            for (sl = 0; sl < TLSF_SL_COUNT; sl++) {
+                purged += purge_list(pool, pool->tlsf->bins[fl][sl], before);
+            }
+        }
+    }
+    else {
+        for (int i = list_index(pool, PURGE_MIN_SIZE); i < BIN_COUNT; i++) {
+            purged += purge_list(pool, pool->bins[i], before);
+        }
+        purged += purge_tree(pool, pool->tree, before);
+    }
+    pool->stats.purged_pages += purged;
+    pool->stats.purged_pages_total += purged;
+    return purged;
+}
+
+// Ends the current decay epoch once it has lasted purge_decay_ms. Called
+// with the lock held after frees.
+static void pool_decay(MagicPool* pool) {
+    if (!pool->purge_decay_ms) return;
+    uint64_t now = now_ns();
+    if (now < pool->purge_deadline) return;
+
+    pool_purge(pool, pool->purge_epoch);
+    pool->purge_epoch++;
+    pool->purge_deadline = now + (uint64_t)pool->purge_decay_ms * 1000000u;
+}
+
+/**
+ * Purges the pages of free blocks that stay unused for between decay_ms and
+ * twice that long. 0 turns decay off (the default). Only pools whose memory
+ * comes from the OS are purged.
+ */
+void magic_pool_set_purge_decay(MagicPool* pool, unsigned decay_ms) {
+    pthread_mutex_lock(&pool->lock);
+    pool->purge_decay_ms = decay_ms;
+    pool->purge_deadline = now_ns() + (uint64_t)decay_ms * 1000000u;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * Hands the whole pages inside every free block of a pool back to the OS
+ * now, e.g. before a process goes idle. Returns the number of pages purged.
+ */
+size_t magic_pool_trim(MagicPool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    fast_consolidate(pool);
+    size_t purged = pool_purge(pool, PURGED);
+    pthread_mutex_unlock(&pool->lock);
+    return purged;
+}
+
+size_t magic_trim() {
+    return magic_pool_trim(magic_default_pool());
+}
+
+/// ------------------------------- TRACING ------------------------------- //
+
+// While tracing, the default pool API appends one MagicTraceRecord per call
+// to a file mapped as a ring buffer. Threads claim slots with one atomic add
+// on the header, so recording takes no lock; the newest `capacity` records
+// survive once the ring wraps.
+
+static MagicTraceHeader* trace;     // NULL while tracing is off
+
+// old_ptr is the block a realloc resized; alignment is only set for memalign.
+// Names a block of the default pool by its offset, or a large block by its
+// mapping. Only addresses are compared: a realloc's old block may already be
+// unmapped.
+static uint64_t trace_id(MagicPool* pool, void* ptr) {
+    char* end = pool->base + __atomic_load_n(&pool->size, __ATOMIC_RELAXED);
+    if ((char*)ptr >= pool->base && (char*)ptr < end) {
+        return block_offset(pool, (Block*)ptr - 1);
+    }
+    return MAGIC_TRACE_LARGE_ID | (uint64_t)((uintptr_t)ptr / OS_PAGE_SIZE);
+}
+
+static void trace_record(int op, size_t size, void* ptr, void* old_ptr, size_t alignment) {
+    MagicTraceHeader* header = __atomic_load_n(&trace, __ATOMIC_ACQUIRE);
+    if (!header) return;
+
+    MagicPool* pool = magic_default_pool();
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t index = __atomic_fetch_add(&header->next, 1, __ATOMIC_RELAXED);
+    MagicTraceRecord* record = (MagicTraceRecord*)(header + 1) + index % header->capacity;
+    record->timestamp = (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+    record->op_size = (uint64_t)op << MAGIC_TRACE_OP_SHIFT | (size & MAGIC_TRACE_SIZE_MASK);
+    record->id = ptr ? trace_id(pool, ptr) : 0;
+    record->old_id = old_ptr ? trace_id(pool, old_ptr) : (uint64_t)(alignment ? FLOOR_LOG2(alignment) : 0);
+}
+
+/**
+ * Starts recording every magic_malloc, magic_calloc, magic_realloc and
+ * magic_free call to the file at path, which holds the newest capacity calls.
+ * Returns 0 on success, -1 if the file cannot be created or mapped.
+ */
+int magic_trace_start(const char* path, size_t capacity) {
+#ifdef _WIN32
+    (void)path; (void)capacity;
+    printf("Error: Tracing is not supported on this platform\n");
+    return -1;
+#else
+    if (trace || capacity == 0) {
+        printf("Error: Tracing is already running or capacity is 0\n");
+        return -1;
+    }
+    size_t bytes = sizeof(MagicTraceHeader) + capacity * sizeof(MagicTraceRecord);
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, (off_t)bytes) != 0) {
+        printf("Error: Could not create trace file %s\n", path);
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    void* map = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        printf("Error: Could not map trace file %s\n", path);
+        return -1;
+    }
+
+    MagicTraceHeader* header = (MagicTraceHeader*)map;
+    header->magic = MAGIC_TRACE_MAGIC;
+    header->capacity = capacity;
+    header->next = 0;
+    __atomic_store_n(&trace, header, __ATOMIC_RELEASE);
+    return 0;
+#endif
+}
+
+/**
+ * Stops tracing and flushes the trace file. No other thread may be inside the
+ * allocator while tracing stops.
+ */
+void magic_trace_stop() {
+#ifndef _WIN32
+    MagicTraceHeader* header = trace;
+    if (!header) return;
+    __atomic_store_n(&trace, NULL, __ATOMIC_RELEASE);
+
+    size_t bytes = sizeof(MagicTraceHeader) + header->capacity * sizeof(MagicTraceRecord);
+    msync(header, bytes, MS_SYNC);
+    munmap(header, bytes);
+#endif
+}
+
+// Places the pool descriptor (and the TLSF index, if any) at the aligned
+// start of region and manages the rest.
+static MagicPool* pool_place(void* region, size_t size, size_t mapping_size, MagicPoolMode mode) {
+    char* start = (char*)ALIGN((uintptr_t)region);
+    char* base = start + ALIGN(sizeof(MagicPool));
+    TlsfIndex* tlsf = NULL;
+    if (mode == MAGIC_MODE_TLSF) {
+        tlsf = (TlsfIndex*)base;
+        base += ALIGN(sizeof(TlsfIndex));
+    }
+    if (base + BLOCK_SIZE + MIN_PAYLOAD > (char*)region + size) {
+        printf("Error: Pool region of %zu bytes is too small\n", size);
+        return NULL;
+    }
+    if ((size_t)((char*)region + size - base) > POOL_MAX_SIZE) {
+        printf("Error: Pool region of %zu bytes exceeds the %zu byte limit\n", size, POOL_MAX_SIZE);
+        return NULL;
+    }
+    MagicPool* pool = (MagicPool*)start;
+    pool->tlsf = tlsf;
+    pool->max_size = 0;
+    pool->mmap_threshold = 0;
+    pool->fit = MAGIC_FIT_FIRST;
+    pool->purge_decay_ms = 0;
+    pool->thread_cache = 0;
+    pthread_mutex_init(&pool->lock, NULL);
+    pool_init(pool, base, ((char*)region + size - base) & ~(size_t)(ALIGNMENT - 1), mapping_size, mode);
+    return pool;
+}
+
+/**
+ * Creates a pool over a region of at least size bytes reserved from the OS.
+ * The pool descriptor lives at the start of the region, so the whole heap is
+ * released with a single magic_pool_destroy.
+ *
+ * @param size Bytes to reserve, descriptor and block metadata included.
+ * @param mode Free block index the pool uses.
+ * @return The new pool or NULL if the OS refused the reservation.
+ */
+MagicPool* magic_pool_create_mode(size_t size, MagicPoolMode mode) {
+    void* region = os_reserve(size);
+    if (!region) {
+        printf("Error: Could not reserve %zu bytes for a pool\n", size);
+        return NULL;
+    }
+    MagicPool* pool = pool_place(region, size, size, mode);
+    if (!pool) {
+        os_release(region, size);
+    }
+    return pool;
+}
+
+MagicPool* magic_pool_create(size_t size) {
+    return magic_pool_create_mode(size, MAGIC_MODE_SEGREGATED);
+}
+
+/**
+ * Creates a pool that starts out with size bytes and grows on demand, up to
+ * max_size bytes, by committing more of an address range reserved up front.
+ * Pointers never move: growth appends free memory at the end of the heap,
+ * merged with a free last block. max_size is capped at the largest heap
+ * the free lists can address. Growable pools use the segregated index.
+ *
+ * @param size Bytes committed at creation, descriptor included.
+ * @param max_size Bytes of address space to reserve.
+ * @return The new pool or NULL if the OS refused the reservation.
+ */
+MagicPool* magic_pool_create_growable(size_t size, size_t max_size) {
+    size = (size + POOL_GROW_STEP - 1) & ~(POOL_GROW_STEP - 1);
+    max_size = (max_size + POOL_GROW_STEP - 1) & ~(POOL_GROW_STEP - 1);
+    if (max_size > (POOL_MAX_SIZE & ~(POOL_GROW_STEP - 1))) {
+        max_size = POOL_MAX_SIZE & ~(POOL_GROW_STEP - 1);
+    }
+    if (max_size < size) {
+        max_size = size;
+    }
+
+    void* region = os_reserve_address_space(max_size);
+    if (!region) {
+        printf("Error: Could not reserve %zu bytes for a pool\n", max_size);
+        return NULL;
+    }
+    MagicPool* pool = os_commit(region, size) ? pool_place(region, size, max_size, MAGIC_MODE_SEGREGATED) : NULL;
+    if (!pool) {
+        os_release(region, max_size);
+        return NULL;
+    }
+    pool->max_size = pool->size + (max_size - size);
+    return pool;
+}
+
+/**
+ * Creates a pool inside a caller-owned buffer. The buffer must outlive the
+ * pool and is never freed by the allocator.
+ *
+ * @param buffer Memory to manage.
+ * @param size Size of buffer in bytes.
+ * @param mode Free block index the pool uses.
+ * @return The new pool or NULL if the buffer is too small to hold a block.
+ */
+MagicPool* magic_pool_from_buffer_mode(void* buffer, size_t size, MagicPoolMode mode) {
+    if (!buffer) {
+        printf("Error: Cannot create a pool over a NULL buffer\n");
+        return NULL;
+    }
+    return pool_place(buffer, size, 0, mode);
+}
+
+MagicPool* magic_pool_from_buffer(void* buffer, size_t size) {
+    return magic_pool_from_buffer_mode(buffer, size, MAGIC_MODE_SEGREGATED);
+}
+
+/**
+ * Destroys a pool. Every pointer it handed out becomes invalid.
+ * OS-reserved regions are returned to the OS; persistent pools are unmapped
+ * and their heap stays in the file for magic_pool_open_file.
+ */
+void magic_pool_destroy(MagicPool* pool) {
+    if (!pool) return;
+    if (default_pool == pool) {
+        magic_set_default_pool(NULL);
+    }
+    if (thread_cache.pool == pool) {
+        magic_thread_cache_flush();
+    }
+    while (pool->large) {
+        LargeBlock* large = pool->large;
+        pool->large = large->next;
+        os_release(large, large->mapping_size);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    if (pool->mapping_size) {
+        os_release(pool, pool->mapping_size);
+    }
+    else if (pool->file) {
+        persistent_close(pool);
+    }
+}
+
+// Returns the free block physically before block using its boundary tag,
+// or NULL when the left neighbour is allocated or block is the first one.
+static Block* prev_free_physical(Block* block) {
+    if (!PREV_IS_FREE(block)) return NULL;
+    size_t prev_size = *((size_t*)block - 1);
+    return (Block*)((char*)block - prev_size - BLOCK_SIZE);
+}
+
+// Absorbs the free block physically after block. The neighbour leaves its bin.
+int coalesce_right(MagicPool* pool, Block* block) {
+    Block* next = next_physical(pool, block);
+    if (next && IS_FREE(next)) {
+        bin_remove(pool, next);
+        SET_SIZE(block, GET_SIZE(block) + BLOCK_SIZE + GET_SIZE(next));
         return 1;
     }
-    return 0;
+    return 0;
+}
+
+// Merges block into the free block physically before it and returns the survivor.
+Block* coalesce_left(MagicPool* pool, Block* block) {
+    Block* prev = prev_free_physical(block);
+    if (prev) {
+        bin_remove(pool, prev);
+        SET_SIZE(prev, GET_SIZE(prev) + BLOCK_SIZE + GET_SIZE(block));
+        return prev;
+    }
+    return block;
+}
+
+// Returns a block no longer counted as in use to the free lists, merged with
+// its free neighbours (or its free buddies).
+static void release_block(MagicPool* pool, Block* block) {
+    if (pool->mode == MAGIC_MODE_BUDDY) {
+        buddy_free(pool, block);
+        return;
+    }
+
+    // The result ages with its largest free neighbour, unless the block
+    // brings pages of its own that were in use until now
+    uint64_t stamp = pool->purge_epoch;
+    char* from = NULL;      // end of the left part's purged pages
+    char* to = NULL;        // start of the right part's purged pages
+    if (GET_SIZE(block) < OS_PAGE_SIZE) {
+        Block* next = next_physical(pool, block);
+        Block* prev = prev_free_physical(block);
+        size_t largest = 0;
+        if (next && IS_FREE(next)) {
+            stamp = free_stamp(pool, next);
+            largest = GET_SIZE(next);
+        }
+        if (prev && GET_SIZE(prev) > largest) {
+            stamp = free_stamp(pool, prev);
+        }
+        if (stamp == PURGED && prev && free_stamp(pool, prev) == PURGED) {
+            size_t pages = purgeable_pages(prev, &from);
+            from += pages * OS_PAGE_SIZE;
+        }
+        if (stamp == PURGED && next && IS_FREE(next) && free_stamp(pool, next) == PURGED) {
+            purgeable_pages(next, &to);
+        }
+    }
+
+    coalesce_right(pool, block);
+    block = coalesce_left(pool, block);
+    bin_insert(pool, block);
+    if (stamp == PURGED) {
+        // The merged block is counted as purged over its whole extent, so
+        // release the pages between its purged parts too: the freed block,
+        // its neighbours' metadata and any neighbour not purged yet
+        char* start;
+        size_t pages = purgeable_pages(block, &start);
+        char* end = start + pages * OS_PAGE_SIZE;
+        if (!from || from < start) from = start;
+        if (!to || to > end) to = end;
+        if (to > from) os_purge(from, (size_t)(to - from));
+    }
+    inherit_stamp(pool, block, stamp);
+}
+
+/// ------------------------------- FAST BINS ------------------------------- //
+
+// Pools with fast bins keep freed blocks of up to FAST_BIN_LIMIT bytes on
+// per-size LIFO stacks instead of coalescing them, so freeing a small block
+// and allocating the same size again is a push and a pop. Fast blocks keep
+// their allocated headers, so neighbours never merge into them. They are
+// merged into the free index all at once (consolidated) when a request finds
+// no free block, when FAST_BIN_MAX_BLOCKS are waiting, and on trim.
+// A fast block links to the next through FreeLinks.next and carries
+// FAST_MARK in FreeLinks.prev, so checked builds can spot double frees.
+
+#define FAST_BIN_LIMIT (FAST_BIN_COUNT * ALIGNMENT)
+#define FAST_BIN_MAX_BLOCKS 1024
+
+static void fast_push(MagicPool* pool, Block* block) {
+    int c = (int)(GET_SIZE(block) / ALIGNMENT) - 1;
+    LINKS(block)->next = pool->fast[c];
+    LINKS(block)->prev = FAST_MARK;
+    pool->fast[c] = block_offset(pool, block);
+    pool->fast_count++;
+}
+
+static Block* fast_pop(MagicPool* pool, size_t size) {
+    int c = (int)(size / ALIGNMENT) - 1;
+    Block* block = offset_block(pool, pool->fast[c]);
+    if (block) {
+        pool->fast[c] = LINKS(block)->next;
+        pool->fast_count--;
+    }
+    return block;
+}
+
+// Frees every fast block into the free index, coalescing as usual.
+static void fast_consolidate(MagicPool* pool) {
+    for (int c = 0; pool->fast_count && c < FAST_BIN_COUNT; c++) {
+        while (pool->fast[c]) {
+            release_block(pool, fast_pop(pool, (size_t)(c + 1) * ALIGNMENT));
+        }
+    }
+}
+
+#if CHECKED
+// Whether block is waiting in a fast bin. Only blocks carrying the mark are
+// looked for, so the list walk is almost never taken for a live block.
+static int fast_holds(MagicPool* pool, Block* block) {
+    if (GET_SIZE(block) > FAST_BIN_LIMIT || LINKS(block)->prev != FAST_MARK) return 0;
+    Block* fast = offset_block(pool, pool->fast[GET_SIZE(block) / ALIGNMENT - 1]);
+    for (; fast; fast = offset_block(pool, LINKS(fast)->next)) {
+        if (fast == block) return 1;
+    }
+    return 0;
+}
+#endif
+
+/**
+ * Turns fast bins on or off for a pool. While they are on, freed blocks of
+ * up to FAST_BIN_LIMIT bytes wait uncoalesced for a malloc of their size.
+ * The bins' heads take a small block of the pool. Returns -1, changing
+ * nothing, for buddy pools or if that block cannot be allocated.
+ */
+int magic_pool_set_fast_bins(MagicPool* pool, int enabled) {
+    if (pool->mode == MAGIC_MODE_BUDDY) return -1;
+    int result = 0;
+    pthread_mutex_lock(&pool->lock);
+    if (enabled && !pool->fast) {
+        pool->fast = pool_malloc(pool, FAST_BIN_COUNT * sizeof(uint32_t));
+        if (pool->fast) {
+            memset(pool->fast, 0, FAST_BIN_COUNT * sizeof(uint32_t));
+        }
+        else result = -1;
+    }
+    else if (!enabled && pool->fast) {
+        uint32_t* heads = pool->fast;
+        fast_consolidate(pool);
+        pool->fast = NULL;
+        pool_free(pool, heads);
+    }
+    DEBUG_CHECK(pool);
+    pthread_mutex_unlock(&pool->lock);
+    return result;
+}
+
+// Frees a block with the pool lock held. Performs backward and forward
+// coalescing in constant time through the boundary tags and files the
+// result in the bin matching its final size. Small blocks of pools with
+// fast bins wait uncoalesced in their fast bin instead.
+static void pool_free(MagicPool* pool, void* ptr) {
+    Block* block_to_free = (Block*)ptr - 1; // Block pointer
+    stats_use(pool, block_to_free, -1);
+    if (pool->fast && GET_SIZE(block_to_free) <= FAST_BIN_LIMIT) {
+        fast_push(pool, block_to_free);
+        if (pool->fast_count >= FAST_BIN_MAX_BLOCKS) {
+            fast_consolidate(pool);
+        }
+        return;
+    }
+    release_block(pool, block_to_free);
+}
+
+/**
+ * Frees memory previously returned by magic_pool_malloc on the same pool.
+ * Checked builds report NULL, foreign and already freed pointers and return;
+ * release builds only ignore NULL.
+ * Small blocks of pools with thread caching enabled go to the calling
+ * thread's cache without taking the pool lock.
+ *
+ * @param pool The pool the memory was allocated from.
+ * @param ptr A pointer to the memory to be freed.
+ */
+void magic_pool_free(MagicPool* pool, void* ptr) {
+    if (!ptr) {
+        REPORT_ERROR(pool, MAGIC_ERROR_NULL_FREE, ptr, 0);
+        return;
+    }
+    if (IS_LARGE(pool, ptr)) {
+        large_free(pool, ptr);
+        return;
+    }
+#if CHECKED
+    MagicError error = check_pointer(pool, ptr, 0);
+    if (error) {
+        REPORT_ERROR(pool, error, ptr, 0);
+        return;
+    }
+#endif
+    if (pool->thread_cache && thread_cache_put(pool, (Block*)ptr - 1)) {
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+#if CHECKED
+    if (pool->fast && fast_holds(pool, (Block*)ptr - 1)) {
+        pthread_mutex_unlock(&pool->lock);
+        REPORT_ERROR(pool, MAGIC_ERROR_DOUBLE_FREE, ptr, 0);
+        return;
+    }
+#endif
+    pool_free(pool, ptr);
+    stats_count(&pool->stats.frees, 1);
+    pool_decay(pool);
+    DEBUG_CHECK(pool);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * Frees the memory pointed to by ptr back to the default pool.
+ *
+ * @param ptr A pointer to the memory to be freed.
+ */
+void magic_free(void* ptr) {
+    trace_record(MAGIC_TRACE_FREE, 0, ptr, NULL, 0);
+    magic_pool_free(magic_default_pool(), ptr);
+}
+
+// TLSF good fit: rounds the request up to the next second-level class so any
+// block in the first non-empty class at or above it fits, found with two bit
+// scans. If that fails, the head of the request's own class is the last resort.
+static Block* tlsf_find(MagicPool* pool, size_t size) {
+    TlsfIndex* tlsf = pool->tlsf;
+    size_t rounded = size;
+    if (size >= TLSF_SMALL_LIMIT) {
+        rounded += ((size_t)1 << (FLOOR_LOG2(size) - TLSF_SL_LOG2)) - 1;
+    }
+
+    int fl, sl;
+    tlsf_mapping(rounded, &fl, &sl);
+    uint32_t sl_map = tlsf->sl_bitmap[fl] & (~0u << sl);     // classes >= sl on this level
+    if (!sl_map) {
+        uint64_t fl_map = fl + 1 < TLSF_FL_COUNT ? tlsf->fl_bitmap & (~(uint64_t)0 << (fl + 1)) : 0;
+        if (fl_map) {
+            fl = __builtin_ctzll(fl_map);
+            sl_map = tlsf->sl_bitmap[fl];
+        }
+    }
+    if (sl_map) {
+        return offset_block(pool, tlsf->bins[fl][__builtin_ctz(sl_map)]);
+    }
+
+    Block* head = offset_block(pool, *bin_head(pool, size));
+    return head && GET_SIZE(head) >= size ? head : NULL;
+}
+
+// Next fit: walks the heap from the rover, wrapping around at its end, and
+// takes the first free block that fits. Costs O(blocks) per search.
+static Block* next_fit_find(MagicPool* pool, size_t size) {
+    Block* start = pool->rover ? offset_block(pool, pool->rover) : (Block*)pool->base;
+    Block* block = start;
+    do {
+        if (IS_FREE(block) && GET_SIZE(block) >= size) return block;
+        block = next_physical(pool, block);
+        if (!block) {
+            block = (Block*)pool->base;
+        }
+    } while (block != start);
+    return NULL;
+}
+
+// Best fit: the exact bins hold one size each, so the first non-empty one at
+// or above the request holds the best small block; every larger block is
+// in the tree.
+static Block* best_fit_find(MagicPool* pool, size_t size) {
+    if (size <= SMALL_BIN_LIMIT) {
+        uint64_t small = pool->bin_bitmap & (~(uint64_t)0 << bin_index(size)) & (((uint64_t)1 << SMALL_BIN_COUNT) - 1);
+        if (small) {
+            return offset_block(pool, pool->bins[__builtin_ctzll(small)]);
+        }
+    }
+    return tree_find(pool, size);
+}
+
+/**
+ * Finds a free block of at least size bytes without walking the whole heap.
+ * Exact small bins are popped directly; otherwise the first non-empty bin
+ * above the request's class is located with one bit scan. Only the request's
+ * own large bin, whose blocks may be smaller than size, is searched first-fit.
+ * TLSF pools never search a list at all.
+ */
+Block* find_free_block(MagicPool* pool, size_t size) {
+    if (pool->mode == MAGIC_MODE_TLSF) {
+        return tlsf_find(pool, size);
+    }
+    if (pool->fit == MAGIC_FIT_NEXT) {
+        return next_fit_find(pool, size);
+    }
+    if (pool->fit == MAGIC_FIT_BEST) {
+        return best_fit_find(pool, size);
+    }
+
+    int index = bin_index(size);
+
+    if (size > SMALL_BIN_LIMIT) {
+        Block* current = offset_block(pool, pool->bins[index]);
+        for (; current; current = offset_block(pool, LINKS(current)->next)) {
+            if (GET_SIZE(current) >= size) return current;
+        }
+    }
+    else if (pool->bins[index]) {
+        return offset_block(pool, pool->bins[index]);
+    }
+
+    if (index + 1 >= BIN_COUNT) return NULL;
+    uint64_t larger = pool->bin_bitmap & (~(uint64_t)0 << (index + 1));
+    if (!larger) return NULL; // no block is large enough
+
+    return offset_block(pool, pool->bins[__builtin_ctzll(larger)]);
+}
+
+// Carves size bytes off the front of a free block that has left its bin.
+// The remainder becomes a new free block in the bin for its size.
+void split_free_block(MagicPool* pool, Block *current, size_t size){
+    Block* new_block = (Block*)((char*)current + size + BLOCK_SIZE);
+    new_block->header = GET_SIZE(current) - size - BLOCK_SIZE;
+    SET_SIZE(current, size);
+
+    bin_insert(pool, new_block);
+}
+// Commits enough of a growable pool's reservation for a free block of size
+// bytes, at least an eighth of the heap so growth takes few system calls,
+// and frees it at the end of the heap. Returns 0 once the reservation is
+// used up. The end of the heap stays POOL_GROW_STEP aligned.
+static int pool_grow(MagicPool* pool, size_t size) {
+    size_t room = pool->max_size - pool->size;
+    size_t grow = size + BLOCK_SIZE > pool->size / 8 ? size + BLOCK_SIZE : pool->size / 8;
+    grow = (grow + POOL_GROW_STEP - 1) & ~(POOL_GROW_STEP - 1);
+    if (grow > room) {
+        if (room < size + BLOCK_SIZE) return 0;
+        grow = room;
+    }
+    if (!os_commit(pool->base + pool->size, grow)) return 0;
+
+    Block* block = (Block*)(pool->base + pool->size);
+    block->header = (grow - BLOCK_SIZE) | (pool->tail_free ? BLOCK_PREV_FREE : 0);
+    Block* tail = prev_free_physical(block);
+    pool->size += grow;
+    release_block(pool, block);
+
+    // Merging with a free tail leaves its boundary tag and the new block's
+    // header inside the merged block, past the fresh mark
+    if (tail) {
+        size_t* old_footer = (size_t*)block - 1;
+        if ((char*)old_footer >= (char*)LINKS(tail) + MIN_PAYLOAD) *old_footer = 0;
+        block->header = 0;
+    }
+    return 1;
+}
+
+// Finds a free block of at least size bytes, growing the pool when none fits.
+static Block* find_or_grow(MagicPool* pool, size_t size) {
+    Block* block = find_free_block(pool, size);
+    if (!block && pool->fast_count) {
+        fast_consolidate(pool);
+        block = find_free_block(pool, size);
+    }
+    if (!block && pool->max_size > pool->size && pool_grow(pool, size)) {
+        block = find_free_block(pool, size);
+    }
+    return block;
+}
+
+// Removes a block of at least size (aligned) bytes from the free index,
+// splitting off the excess. Returns NULL when nothing fits.
+static Block* pool_take_block(MagicPool* pool, size_t size) {
+    if (pool->mode == MAGIC_MODE_BUDDY) {
+        Block* block = buddy_take(pool, size);
+        if (block) stats_use(pool, block, 1);
+        return block;
+    }
+
+    if (pool->fast && size <= FAST_BIN_LIMIT) {
+        Block* block = fast_pop(pool, size);
+        if (block) {
+            stats_use(pool, block, 1);
+            return block;
+        }
+    }
+
+    Block* current = find_or_grow(pool, size);
+    if (!current) return NULL;
+
+    // The part split off stays as old as the block it was cut from
+    uint64_t stamp = free_stamp(pool, current);
+    bin_remove(pool, current);
+    current = allocate_block(pool, current, size);
+    Block* rest = next_physical(pool, current);
+    if (rest && IS_FREE(rest)) {
+        inherit_stamp(pool, rest, stamp);
+        pool->rover = block_offset(pool, rest);
+    }
+    return current;
+}
+
+// Hands out a free block already unlinked from its bin, splitting off the
+// part the request does not need.
+static Block* allocate_block(MagicPool* pool, Block* current, size_t size) {
+    current->header &= ~(size_t)BLOCK_FREE;
+    if (GET_SIZE(current) >= size + BLOCK_SIZE + MIN_PAYLOAD) {// split block and create new free block
+        split_free_block(pool, current, size);
+    }
+    else {// available memory is exact size of requested or not enough for a new block
+        mark_next(pool, current, 0);
+    }
+    stats_use(pool, current, 1);
+    return current;
+}
+
+// Allocates with the pool lock held.
+static void* pool_malloc(MagicPool* pool, size_t size) {
+    if (size <= 0 || size > pool_capacity(pool)) {
+        REPORT_ERROR(pool, MAGIC_ERROR_INVALID_SIZE, NULL, size);
+        stats_count(&pool->stats.failed_allocations, 1);
+        return NULL;
+    }
+
+    size = REQUEST_SIZE(size);
+    Block* current = pool_take_block(pool, size);
+    
+    if (!current) {
+        stats_count(&pool->stats.failed_allocations, 1);
+        REPORT_ERROR(pool, MAGIC_ERROR_OUT_OF_MEMORY, NULL, size);
+        return NULL;
+    }
+    return(void*)(current + 1);
+}
+
+/**
+ * Allocates memory of the specified size from a pool.
+ * If the allocation is successful, returns a pointer to the allocated memory.
+ * If the allocation fails, reports the error (checked builds) and returns NULL.
+ * Safe to call from several threads; small requests on pools with thread
+ * caching enabled are usually served without taking the pool lock.
+ *
+ * @param pool The pool to allocate from.
+ * @param size The size of the memory to allocate.
+ * @return A pointer to the allocated memory or NULL if the allocation fails.
+ */
+void* magic_pool_malloc(MagicPool* pool, size_t size) {
+    if (pool->mmap_threshold && size >= pool->mmap_threshold) {
+        void* ptr = large_malloc(pool, size);
+        if (ptr) stats_count(&pool->stats.allocations, 1);
+        return ptr;
+    }
+    if (pool->thread_cache && size > 0 && size <= TCACHE_MAX_SIZE) {
+        Block* block = thread_cache_get(pool, REQUEST_SIZE(size));
+        if (block) return (void*)(block + 1);
+    }
+    pthread_mutex_lock(&pool->lock);
+    void* ptr = pool_malloc(pool, size);
+    if (ptr) stats_count(&pool->stats.allocations, 1);
+    DEBUG_CHECK(pool);
+    pthread_mutex_unlock(&pool->lock);
+    return ptr;
+}
+
+/**
+ * Allocates memory of the specified size from the default pool.
+ *
+ * @param size The size of the memory to allocate.
+ * @return A pointer to the allocated memory or NULL if the allocation fails.
+ */
+void* magic_malloc(size_t size) {
+    void* ptr = magic_pool_malloc(magic_default_pool(), size);
+    trace_record(MAGIC_TRACE_MALLOC, size, ptr, NULL, 0);
+    return ptr;
+}
+
+// Allocates with the pool lock held, placing the payload at a multiple of
+// alignment. The free block found has room for the worst leading gap; the
+// gap before the aligned payload is split off and goes back to its bin.
+static void* pool_memalign(MagicPool* pool, size_t alignment, size_t size) {
+    if (alignment <= ALIGNMENT) {
+        return pool_malloc(pool, size);
+    }
+    if (size <= 0 || size > pool_capacity(pool) || alignment > pool_capacity(pool)) {
+        REPORT_ERROR(pool, MAGIC_ERROR_INVALID_SIZE, NULL, size);
+        stats_count(&pool->stats.failed_allocations, 1);
+        return NULL;
+    }
+    if (pool->mode == MAGIC_MODE_BUDDY) {           // buddy blocks cannot start at arbitrary offsets
+        REPORT_ERROR(pool, MAGIC_ERROR_INVALID_ALIGNMENT, NULL, size);
+        stats_count(&pool->stats.failed_allocations, 1);
+        return NULL;
+    }
+
+    size = REQUEST_SIZE(size);
+    Block* block = find_or_grow(pool, size + alignment + BLOCK_SIZE + MIN_PAYLOAD);
+    if (!block) {
+        stats_count(&pool->stats.failed_allocations, 1);
+        REPORT_ERROR(pool, MAGIC_ERROR_OUT_OF_MEMORY, NULL, size);
+        return NULL;
+    }
+    bin_remove(pool, block);
+
+    // A gap too small to hold a free block moves on to the next aligned address
+    uintptr_t payload = (uintptr_t)(block + 1);
+    uintptr_t aligned = (payload + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    if (aligned != payload && aligned - payload < BLOCK_SIZE + MIN_PAYLOAD) {
+        aligned += alignment;
+    }
+    if (aligned != payload) {
+        size_t gap = aligned - payload;
+        Block* rest = (Block*)aligned - 1;
+        rest->header = GET_SIZE(block) - gap;
+        SET_SIZE(block, gap - BLOCK_SIZE);
+        bin_insert(pool, block);
+        block = rest;
+    }
+    return (void*)(allocate_block(pool, block, size) + 1);
+}
+
+/**
+ * Allocates size bytes from a pool at an address that is a multiple of
+ * alignment, which must be a power of two. The memory is freed with
+ * magic_pool_free like any other block; a realloc that has to move it does
+ * not keep the alignment. Buddy pools only support the default alignment.
+ *
+ * @return A pointer to the allocated memory or NULL if the allocation fails.
+ */
+void* magic_pool_memalign(MagicPool* pool, size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1))) {
+        REPORT_ERROR(pool, MAGIC_ERROR_INVALID_ALIGNMENT, NULL, size);
+        return NULL;
+    }
+    pthread_mutex_lock(&pool->lock);
+    void* ptr = pool_memalign(pool, alignment, size);
+    if (ptr) stats_count(&pool->stats.allocations, 1);
+    DEBUG_CHECK(pool);
+    pthread_mutex_unlock(&pool->lock);
+    return ptr;
+}
+
+void* magic_memalign(size_t alignment, size_t size) {
+    void* ptr = magic_pool_memalign(magic_default_pool(), alignment, size);
+    trace_record(MAGIC_TRACE_MEMALIGN, size, ptr, NULL, alignment);
+    return ptr;
+}
+
+void* magic_aligned_alloc(size_t alignment, size_t size) {
+    return magic_memalign(alignment, size);
+}
+
+/**
+ * posix_memalign for the default pool: stores the allocation in *memptr and
+ * returns 0, EINVAL if alignment is not a power of two multiple of
+ * sizeof(void*), or ENOMEM if the pool cannot satisfy the request.
+ */
+int magic_posix_memalign(void** memptr, size_t alignment, size_t size) {
+    if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1))) {
+        return EINVAL;
+    }
+    void* ptr = magic_memalign(alignment, size);
+    if (!ptr) return ENOMEM;
+    *memptr = ptr;
+    return 0;
+}
+
+/// ------------------------------- BATCHES ------------------------------- //
+
+// Takes one free run big enough for all n blocks and carves it in place, so
+// the blocks are adjacent and the free index is searched once. Buddy pools,
+// and pools without such a run, take the blocks one by one instead.
+static size_t pool_malloc_batch(MagicPool* pool, size_t size, size_t n, void** out) {
+    if (size <= 0 || size > pool_capacity(pool)) {
+        REPORT_ERROR(pool, MAGIC_ERROR_INVALID_SIZE, NULL, size);
+        stats_count(&pool->stats.failed_allocations, 1);
+        return 0;
+    }
+    size = REQUEST_SIZE(size);
+
+    size_t done = 0;
+    size_t stride = BLOCK_SIZE + size;
+    Block* run = NULL;
+    if (pool->mode != MAGIC_MODE_BUDDY && n > 1 && n <= pool_capacity(pool) / stride) {
+        run = pool_take_block(pool, n * stride - BLOCK_SIZE);
+    }
+    if (run) {
+        // The run's tail (anything the split left over) goes to the last block
+        size_t total = GET_SIZE(run);
+        stats_use(pool, run, -1);
+        Block* block = run;
+        for (done = 0; done < n; done++) {
+            size_t payload = done + 1 < n ? size : total - (n - 1) * stride;
+            SET_SIZE(block, payload);
+            if (done > 0) block->header = payload;
+            stats_use(pool, block, 1);
+            out[done] = block + 1;
+            block = (Block*)((char*)block + stride);
+        }
+    }
+    for (; done < n; done++) {
+        Block* block = pool_take_block(pool, size);
+        if (!block) {
+            stats_count(&pool->stats.failed_allocations, 1);
+            REPORT_ERROR(pool, MAGIC_ERROR_OUT_OF_MEMORY, NULL, size);
+            break;
+        }
+        out[done] = block + 1;
+    }
+    for (size_t i = done; i < n; i++) {
+        out[i] = NULL;
+    }
+    return done;
+}
+
+/**
+ * Allocates n blocks of size bytes from a pool under one lock acquisition,
+ * as one contiguous run split in place when a large enough free block exists.
+ * Fills out[0..n) and returns how many blocks were allocated; the rest of
+ * out is set to NULL if the pool runs out.
+ */
+size_t magic_pool_malloc_batch(MagicPool* pool, size_t size, size_t n, void** out) {
+    pthread_mutex_lock(&pool->lock);
+    size_t done = pool_malloc_batch(pool, size, n, out);
+    stats_count(&pool->stats.allocations, done);
+    DEBUG_CHECK(pool);
+    pthread_mutex_unlock(&pool->lock);
+    return done;
+}
+
+static int compare_addresses(const void* a, const void* b) {
+    uintptr_t x = (uintptr_t)*(void* const*)a, y = (uintptr_t)*(void* const*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Frees n blocks of a pool under one lock acquisition. The pointers are
+ * sorted by address (ptrs is reordered in place) and each run of physically
+ * adjacent blocks is merged before it goes back to the free lists, so a run
+ * costs a single coalesce and bin insert. NULL entries are skipped.
+ */
+void magic_pool_free_batch(MagicPool* pool, void** ptrs, size_t n) {
+    qsort(ptrs, n, sizeof(void*), compare_addresses);
+
+    pthread_mutex_lock(&pool->lock);
+    size_t freed = 0;
+    Block* run = NULL;
+    for (size_t i = 0; i < n; i++) {
+        if (!ptrs[i]) continue;
+        if (IS_LARGE(pool, ptrs[i])) {
+            LargeBlock* large = large_find(pool, ptrs[i]);
+            if (large) {
+                large_unlink(pool, large);
+                os_release(large, large->mapping_size);
+                freed++;
+            }
+            continue;
+        }
+#if CHECKED
+        MagicError error = i > 0 && ptrs[i] == ptrs[i - 1] ? MAGIC_ERROR_DOUBLE_FREE : check_pointer(pool, ptrs[i], 0);
+        if (!error && pool->fast && fast_holds(pool, (Block*)ptrs[i] - 1)) {
+            error = MAGIC_ERROR_DOUBLE_FREE;
+        }
+        if (error) {
+            REPORT_ERROR(pool, error, ptrs[i], 0);
+            continue;
+        }
+#endif
+        Block* block = (Block*)ptrs[i] - 1;
+        stats_use(pool, block, -1);
+        freed++;
+
+        // Extend the current run when this block directly follows it
+        if (run && pool->mode != MAGIC_MODE_BUDDY && next_physical(pool, run) == block) {
+            SET_SIZE(run, GET_SIZE(run) + BLOCK_SIZE + GET_SIZE(block));
+            continue;
+        }
+        if (run) release_block(pool, run);
+        run = block;
+    }
+    if (run) release_block(pool, run);
+    stats_count(&pool->stats.frees, freed);
+    pool_decay(pool);
+    DEBUG_CHECK(pool);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+size_t magic_malloc_batch(size_t size, size_t n, void** out) {
+    size_t done = magic_pool_malloc_batch(magic_default_pool(), size, n, out);
+    for (size_t i = 0; i < done; i++) {
+        trace_record(MAGIC_TRACE_MALLOC, size, out[i], NULL, 0);
+    }
+    return done;
+}
+
+void magic_free_batch(void** ptrs, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (ptrs[i]) trace_record(MAGIC_TRACE_FREE, 0, ptrs[i], NULL, 0);
+    }
+    magic_pool_free_batch(magic_default_pool(), ptrs, n);
+}
+
+// Allocates zeroed memory with the pool lock held. Memory past the fresh
+// mark was zero when the pool got it and no block has reached it since; only
+// the metadata of the free block it belongs to has been written there: a
+// header and links right after the mark, and a boundary tag at the end of
+// the heap. So only the part of the block before that, and the tag if the
+// block reaches it, need clearing.
+static void* pool_calloc(MagicPool* pool, size_t size) {
+    size_t dirty = pool->fresh + BLOCK_SIZE + MIN_PAYLOAD;
+    char* ptr = pool_malloc(pool, size);
+    if (!ptr) return NULL;
+
+    size_t start = (size_t)(ptr - pool->base);
+    if (start < dirty) {
+        memset(ptr, 0, dirty - start < size ? dirty - start : size);
+    }
+    if (start + size > pool->size - sizeof(size_t)) {
+        memset(pool->base + pool->size - sizeof(size_t), 0, start + size - (pool->size - sizeof(size_t)));
+    }
+    return ptr;
+}
+
+/**
+ * Allocates zeroed memory for num elements of size bytes each from a pool.
+ * Memory known to be zero already, fresh mappings for large blocks and the
+ * part of an OS-backed heap no block has reached yet, is not cleared again,
+ * so large zeroed buffers cost page faults only.
+ *
+ * @return A pointer to the memory, or NULL if the allocation fails or
+ *         num * size overflows (reported as MAGIC_ERROR_INVALID_SIZE).
+ */
+void* magic_pool_calloc(MagicPool* pool, size_t num, size_t size)
+{
+    size_t total_size;
+    if (__builtin_mul_overflow(num, size, &total_size)) {
+        REPORT_ERROR(pool, MAGIC_ERROR_INVALID_SIZE, NULL, SIZE_MAX);
+        stats_count(&pool->stats.failed_allocations, 1);
+        return NULL;
+    }
+    if ((pool->mmap_threshold && total_size >= pool->mmap_threshold) ||
+        (pool->thread_cache && total_size > 0 && total_size <= TCACHE_MAX_SIZE)) {
+        void* ptr = magic_pool_malloc(pool, total_size);
+        if (ptr && !IS_MMAPPED((Block*)ptr - 1)) memset(ptr, 0, total_size);    // fresh mappings are zeroed
+        return ptr;
+    }
+    pthread_mutex_lock(&pool->lock);
+    void* ptr = pool_calloc(pool, total_size);
+    if (ptr) stats_count(&pool->stats.allocations, 1);
+    DEBUG_CHECK(pool);
+    pthread_mutex_unlock(&pool->lock);
+    return ptr;
+}
+
+void* magic_calloc(size_t num, size_t size)
+{
+    void* ptr = magic_pool_calloc(magic_default_pool(), num, size);
+    trace_record(MAGIC_TRACE_CALLOC, ptr ? num * size : 0, ptr, NULL, 0);
+    return ptr;
+}
+
+// Gives everything past the first size bytes of an allocated block back to
+// the pool, merged with a free right neighbour. Keeps tails too small to
+// hold a block.
+static void shrink_block(MagicPool* pool, Block* block, size_t size) {
+    if (GET_SIZE(block) < size + BLOCK_SIZE + MIN_PAYLOAD) return;
+
+    Block* tail = (Block*)((char*)block + BLOCK_SIZE + size);
+    tail->header = GET_SIZE(block) - size - BLOCK_SIZE;
+    SET_SIZE(block, size);
+
+    coalesce_right(pool, tail);
+    bin_insert(pool, tail);
+}
+
+// Grows an allocated block to at least size bytes by absorbing its free right
+// neighbour. Returns 0, leaving the block untouched, if that is not enough.
+static int grow_block_in_place(MagicPool* pool, Block* block, size_t size) {
+    Block* next = next_physical(pool, block);
+    if (!next || !IS_FREE(next) || GET_SIZE(block) + BLOCK_SIZE + GET_SIZE(next) < size) return 0;
+
+    bin_remove(pool, next);
+    SET_SIZE(block, GET_SIZE(block) + BLOCK_SIZE + GET_SIZE(next));
+    if (GET_SIZE(block) >= size + BLOCK_SIZE + MIN_PAYLOAD) {
+        split_free_block(pool, block, size);
+    }
+    else {
+        mark_next(pool, block, 0);
+    }
+    return 1;
+}
+
+// Resizes with the pool lock held. Shrinking splits off and frees the tail,
+// growing extends into a free right neighbour, and only when that is not
+// possible is the data moved to a new block. On failure the original block
+// is left intact.
+static void* pool_realloc(MagicPool* pool, void* ptr, size_t new_size)
+{
+    Block* current_block = (Block*)ptr - 1; // Block pointer
+    if (IS_FREE(current_block)) {
+        return pool_malloc(pool, new_size);
+    }
+
+    if (new_size <= 0) {
+        pool_free(pool, ptr);
+        return NULL;
+    }
+
+    // In place resizes leave the block in use at its new size
+    size_t size = REQUEST_SIZE(new_size);
+    stats_use(pool, current_block, -1);
+    int resized = 1;
+    if (pool->mode == MAGIC_MODE_BUDDY) {
+        if (size <= GET_SIZE(current_block)) {
+            buddy_shrink(pool, current_block, size);
+        }
+        else resized = 0;
+    }
+    else if (size <= GET_SIZE(current_block)) {
+        shrink_block(pool, current_block, size);
+    }
+    else {
+        resized = grow_block_in_place(pool, current_block, size);
+    }
+    stats_use(pool, current_block, 1);
+    if (resized) {
+        return ptr;
+    }
+
+    void* new_ptr = pool_malloc(pool, new_size);
+    if (new_ptr) {
+        memcpy(new_ptr, ptr, GET_SIZE(current_block));
+        pool_free(pool, ptr);
+    }
+    return new_ptr;
+}
+
+void* magic_pool_realloc(MagicPool* pool, void* ptr, size_t new_size)
+{
+    if (!ptr) return magic_pool_malloc(pool, new_size);
+    if (IS_LARGE(pool, ptr)) return large_realloc(pool, ptr, new_size);
+#if CHECKED
+    MagicError error = check_pointer(pool, ptr, 1);
+    if (error) {
+        REPORT_ERROR(pool, error, ptr, new_size);
+        return NULL;
+    }
+#endif
+
+    // Growing past the threshold moves the block to a mapping of its own.
+    // Only the block's owner changes its size, but neighbours update the
+    // header's flags under the lock, so it is read atomically.
+    size_t old_size = __atomic_load_n(&((Block*)ptr - 1)->header, __ATOMIC_RELAXED) & ~(size_t)BLOCK_FLAGS;
+    if (pool->mmap_threshold && new_size >= pool->mmap_threshold && new_size > old_size) {
+        void* new_ptr = large_malloc(pool, new_size);
+        if (new_ptr) {
+            memcpy(new_ptr, ptr, old_size);
+            pthread_mutex_lock(&pool->lock);
+            stats_count(&pool->stats.reallocs, 1);
+            pool_free(pool, ptr);
+            DEBUG_CHECK(pool);
+            pthread_mutex_unlock(&pool->lock);
+        }
+        return new_ptr;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    stats_count(&pool->stats.reallocs, 1);
+    void* new_ptr = pool_realloc(pool, ptr, new_size);
+    pool_decay(pool);
+    DEBUG_CHECK(pool);
+    pthread_mutex_unlock(&pool->lock);
+    return new_ptr;
+}
+
+void* magic_realloc(void* ptr, size_t new_size)
+{
+    void* new_ptr = magic_pool_realloc(magic_default_pool(), ptr, new_size);
+    trace_record(MAGIC_TRACE_REALLOC, new_size, new_ptr, ptr, 0);
+    return new_ptr;
+}
+
+/**
+ * Returns the number of bytes usable at ptr, which may exceed the size that
+ * was requested, or 0 for NULL. Works for blocks of any pool.
+ */
+size_t magic_usable_size(void* ptr) {
+    if (!ptr) return 0;
+    return __atomic_load_n(&((Block*)ptr - 1)->header, __ATOMIC_RELAXED) & ~(size_t)BLOCK_FLAGS;
+}
+
+/**
+ * Copies a pool's statistics into stats. Reading them costs no heap walk, so
+ * it is cheap enough to export periodically. Calls served by other threads'
+ * caches reach the counters in batches of TCACHE_STATS_BATCH.
+ */
+void magic_pool_stats(MagicPool* pool, MagicStats* stats) {
+    if (thread_cache.pool == pool) {
+        thread_cache_publish(&thread_cache);
+    }
+    pthread_mutex_lock(&pool->lock);
+    MagicStats* current = &pool->stats;
+    stats->bytes_in_use = current->bytes_in_use;
+    stats->peak_bytes_in_use = current->peak_bytes_in_use;
+    stats->free_bytes = current->free_bytes;
+    stats->largest_free_block = largest_free_block(pool);
+    stats->free_blocks = current->free_blocks;
+    stats->allocations = __atomic_load_n(&current->allocations, __ATOMIC_RELAXED);
+    stats->frees = __atomic_load_n(&current->frees, __ATOMIC_RELAXED);
+    stats->reallocs = __atomic_load_n(&current->reallocs, __ATOMIC_RELAXED);
+    stats->failed_allocations = __atomic_load_n(&current->failed_allocations, __ATOMIC_RELAXED);
+    stats->mapped_bytes = current->mapped_bytes;
+    stats->purged_pages = current->purged_pages;
+    stats->purged_pages_total = current->purged_pages_total;
+    memcpy(stats->size_classes, current->size_classes, sizeof(stats->size_classes));
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void magic_stats(MagicStats* stats) {
+    magic_pool_stats(magic_default_pool(), stats);
+}
+
+/**
+ * Prints the current state of a pool.
+ * Displays metadata and whether each block is allocated or free.
+ */
+void magic_pool_visualize(MagicPool* pool)
+{
+    Block* current = (Block*)pool->base;
+    int blockIndex = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    printf("\n[Memory Pool Visualization]\n");
+    printf("Pool Size: %zu bytes\n\n", pool->size);
+
+    while ((char*)current < pool->base + pool->size) {
+        // Masking the address to fit into 9 digits
+        uintptr_t startAddress = (uintptr_t)current % 1000000000;
+        uintptr_t dataStart = ((uintptr_t)current + BLOCK_SIZE) % 1000000000;
+        uintptr_t dataEnd = (dataStart + GET_SIZE(current) - 1) % 1000000000;
+
+        printf("Block %d:\n", blockIndex++);
+        printf("  Start Address: %09lu\n", (unsigned long)startAddress);
+        printf("  Block Size: %zu bytes\n", GET_SIZE(current) + BLOCK_SIZE);
+        printf("  Allocated: %s\n", IS_FREE(current) ? "NO (Free)" : "YES (Allocated)");
+        printf("  Data Range: [%09lu - %09lu] (%zu bytes)\n", (unsigned long)dataStart, (unsigned long)dataEnd, GET_SIZE(current));
+
+        // Move to the next block
+        current = (Block*)((char*)current + BLOCK_SIZE + GET_SIZE(current));
+        printf("\n");
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void visualize_memory_pool()
+{
+    magic_pool_visualize(magic_default_pool());
+}
+
+/// ------------------------------- ARENAS ------------------------------- //
+
+#define ARENA_MIN_CHUNK ((size_t)256)
+#define ARENA_DEFAULT_CHUNK ((size_t)4096)
+#define ARENA_MAX_CHUNK ((size_t)1024 * 1024)
+
+// Header of a chunk, a block of the arena's pool; the bump region follows it.
+typedef struct ArenaChunk {
+    struct ArenaChunk* prev;    // older chunk, NULL for the first
+    char* end;
+} ArenaChunk;
+
+#define CHUNK_DATA(chunk) ((char*)(chunk) + ALIGN(sizeof(ArenaChunk)))
+
+// Starts a chunk for a request of size bytes that does not fit the current
+// one. The chunk is at least the arena's next chunk size, and that size
+// doubles each time, so an arena of n bytes takes O(log n) chunks.
+static void* arena_grow(MagicArena* arena, size_t size) {
+    size_t payload = size > arena->chunk_size ? size : arena->chunk_size;
+    ArenaChunk* chunk = magic_pool_malloc(arena->pool, ALIGN(sizeof(ArenaChunk)) + payload);
+    if (!chunk) return NULL;
+
+    // The block may be bigger than asked for; all of it is bumped from
+    chunk->prev = arena->chunk;
+    chunk->end = (char*)chunk + magic_usable_size(chunk);
+    arena->chunk = chunk;
+    arena->next = CHUNK_DATA(chunk) + size;
+    arena->end = chunk->end;
+    if (arena->chunk_size < ARENA_MAX_CHUNK) {
+        arena->chunk_size *= 2;
+    }
+    return CHUNK_DATA(chunk);
 }
 
-int coalesce_left(Block* prev, Block* block) {
-    if ((Block*)((char*)prev + BLOCK_SIZE + prev->size) == block) { // if previous free block is adjacent to the current block
-        prev->size += BLOCK_SIZE + block->size;
-        //prev->next = block->next;
-        return 1;
+// Gives back every chunk newer than keep, which becomes the current chunk.
+static void arena_release(MagicArena* arena, ArenaChunk* keep) {
+    while (arena->chunk != keep) {
+        ArenaChunk* chunk = arena->chunk;
+        arena->chunk = chunk->prev;
+        magic_pool_free(arena->pool, chunk);
     }
-    return 0;
+    arena->end = keep ? keep->end : NULL;
 }
 
+/**
+ * Creates an arena whose chunks are allocated from pool, or from the default
+ * pool if pool is NULL. chunk_size is the size of the first chunk, 0 for
+ * ARENA_DEFAULT_CHUNK; no memory is taken until the first allocation.
+ * Returns NULL if the arena itself cannot be allocated.
+ */
+MagicArena* magic_arena_create(MagicPool* pool, size_t chunk_size) {
+    if (!pool) {
+        pool = magic_default_pool();
+    }
+    MagicArena* arena = magic_pool_malloc(pool, sizeof(MagicArena));
+    if (!arena) return NULL;
 
-void insert_block(Block *block_to_free) {
-    Block *prev = NULL;
-    Block *current = free_list;
+    arena->pool = pool;
+    arena->chunk = NULL;
+    arena->next = arena->end = NULL;
+    arena->chunk_size = chunk_size ? ALIGN(chunk_size) : ARENA_DEFAULT_CHUNK;
+    if (arena->chunk_size < ARENA_MIN_CHUNK) {
+        arena->chunk_size = ARENA_MIN_CHUNK;
+    }
+    return arena;
+}
 
-    // Traverse the free list to find the correct position, add block to free list and update order
-    while (current) {
-        if (current > block_to_free) {
-            // block_to_free->next = current;  // attach block to free to next
-            // if(prev) {
-            //     prev->next = block_to_free;     // attach previous to block to free
-            // }
-            break;
-        }
-        prev = current;
-        current = current->next;
+/**
+ * Allocates size bytes from an arena, aligned like magic_malloc's blocks.
+ * The memory cannot be freed on its own; it lives until the arena is
+ * rewound past it, reset or destroyed. Returns NULL if size is 0 or a new
+ * chunk cannot be allocated.
+ */
+void* magic_arena_alloc(MagicArena* arena, size_t size) {
+    if (size == 0 || size > SIZE_MAX / 2) {
+        REPORT_ERROR(arena->pool, MAGIC_ERROR_INVALID_SIZE, NULL, size);
+        return NULL;
+    }
+    size = ALIGN(size);
+    if (!arena->chunk || (size_t)(arena->end - arena->next) < size) {
+        return arena_grow(arena, size);
     }
+    void* ptr = arena->next;
+    arena->next += size;
+    return ptr;
+}
 
-    // Insert the block back into the free list (sorted order)
-    if (prev) { // middle or end of list
+/**
+ * Returns a savepoint that magic_arena_rewind goes back to.
+ */
+MagicArenaMark magic_arena_mark(MagicArena* arena) {
+    MagicArenaMark mark = { arena->chunk, arena->next };
+    return mark;
+}
 
-        int right = coalesce_right(current,block_to_free);
-        if (right)
-        {
-            prev->next = block_to_free;
-            current = block_to_free->next;
-        }
-        int left =  coalesce_left(prev, block_to_free);
-        if (left)
-        {
-            prev->next = current;
-        }
-        if (!right && ! left)
-        {
-            prev->next = block_to_free;
-            block_to_free->next = current;
-        }
+/**
+ * Frees everything allocated from an arena since mark was taken, giving back
+ * the chunks started since. Marks taken after mark are invalidated, as is
+ * mark itself by an earlier rewind past it or a reset.
+ */
+void magic_arena_rewind(MagicArena* arena, MagicArenaMark mark) {
+#if CHECKED
+    ArenaChunk* chunk = arena->chunk;
+    while (chunk != mark.chunk && chunk) {
+        chunk = chunk->prev;
     }
-    else { // head of the list
-        // coallece right?
-        if (!coalesce_right(current,block_to_free)) {
-            //block_to_free->next = free_list;
-            block_to_free->next = current;
-        }
-        //block_to_free->next = current;
-        free_list = block_to_free;
+    if (chunk != mark.chunk || (chunk && (mark.next < CHUNK_DATA(chunk) || mark.next > chunk->end))) {
+        REPORT_ERROR(arena->pool, MAGIC_ERROR_INVALID_POINTER, mark.next, 0);
+        return;
+    }
+#endif
+    arena_release(arena, mark.chunk);
+    arena->next = mark.next;
+}
+
+/**
+ * Frees everything allocated from an arena in one call. The newest chunk,
+ * the largest, is kept for the allocations that follow; the others go back
+ * to the pool.
+ */
+void magic_arena_reset(MagicArena* arena) {
+    ArenaChunk* keep = arena->chunk;
+    if (!keep) return;
+
+    ArenaChunk* older = keep->prev;
+    while (older) {
+        ArenaChunk* prev = older->prev;
+        magic_pool_free(arena->pool, older);
+        older = prev;
     }
+    keep->prev = NULL;
+    arena->next = CHUNK_DATA(keep);
+    arena->end = keep->end;
+}
+
+/**
+ * Frees an arena and everything allocated from it.
+ */
+void magic_arena_destroy(MagicArena* arena) {
+    if (!arena) return;
+    arena_release(arena, NULL);
+    magic_pool_free(arena->pool, arena);
 }
+
+/// ------------------------------- SHARDED POOLS ------------------------------- //
+
+#define SHARD_MIN_SIZE ((size_t)64 * 1024)
+
+static unsigned shard_tickets;                  // threads given a MAGIC_SHARD_THREAD shard so far
+static __thread unsigned shard_ticket;          // this thread's ticket plus one, 0 until it needs one
+
 /**
- * Frees the memory pointed to by ptr.
- * If the pointer is NULL, prints an error message and returns.
- * Performs backward and forward coalescing to merge adjacent free blocks.
+ * Creates a sharded pool over one reservation of size bytes, split evenly
+ * between the shards. shards is capped at MAGIC_MAX_SHARDS; 0 makes one per
+ * online CPU. Each shard is a segregated pool with its own lock.
  *
- * @param ptr A pointer to the memory to be freed.
+ * @param size Bytes to reserve, descriptors and block metadata included.
+ * @param shards Number of shards.
+ * @param policy How threads are mapped to shards.
+ * @return The new pool or NULL if size leaves a shard under 64 KiB or the
+ *         OS refused the reservation.
  */
-void magic_free(void* ptr) {
-    if (!ptr) {
-        printf("Error: Attempted to free Null pointer\n");
-        return;
+MagicShardedPool* magic_sharded_pool_create(size_t size, unsigned shards, MagicShardPolicy policy) {
+    if (shards == 0) {
+#ifdef _WIN32
+        shards = 1;
+#else
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        shards = cpus > 0 ? (unsigned)cpus : 1;
+#endif
+    }
+    if (shards > MAGIC_MAX_SHARDS) {
+        shards = MAGIC_MAX_SHARDS;
+    }
+    size_t header = (sizeof(MagicShardedPool) + OS_PAGE_SIZE - 1) & ~(OS_PAGE_SIZE - 1);
+    size_t shard_size = size > header ? ((size - header) / shards) & ~(OS_PAGE_SIZE - 1) : 0;
+    if (shard_size < SHARD_MIN_SIZE) {
+        printf("Error: %zu bytes cannot hold %u shards\n", size, shards);
+        return NULL;
     }
 
-    Block* block_to_free = (Block*)ptr - 1; // Block pointer
-    if (block_to_free->free) {
-        printf("Error: Memory Requested to free is already free\n");
-        return;
+    size_t mapping_size = header + shards * shard_size;
+    char* region = os_reserve(mapping_size);
+    if (!region) {
+        printf("Error: Could not reserve %zu bytes for a pool\n", mapping_size);
+        return NULL;
+    }
+    MagicShardedPool* sharded = (MagicShardedPool*)region;
+    sharded->base = region + header;
+    sharded->shard_size = shard_size;
+    sharded->mapping_size = mapping_size;
+    sharded->count = shards;
+    sharded->policy = policy;
+    for (unsigned i = 0; i < shards; i++) {
+        sharded->shards[i] = pool_place(sharded->base + i * shard_size, shard_size, 0, MAGIC_MODE_SEGREGATED);
+    }
+    return sharded;
+}
+
+/**
+ * Destroys a sharded pool. Every pointer it handed out becomes invalid.
+ */
+void magic_sharded_pool_destroy(MagicShardedPool* sharded) {
+    if (!sharded) return;
+    for (unsigned i = 0; i < sharded->count; i++) {
+        magic_pool_destroy(sharded->shards[i]);
+    }
+    os_release(sharded, sharded->mapping_size);
+}
+
+/**
+ * Returns the shard the calling thread allocates from. MAGIC_SHARD_CPU falls
+ * back to the thread's round-robin shard where the CPU cannot be read.
+ */
+MagicPool* magic_sharded_pool_local(MagicShardedPool* sharded) {
+#ifdef __linux__
+    if (sharded->policy == MAGIC_SHARD_CPU) {
+        int cpu = sched_getcpu();
+        if (cpu >= 0) return sharded->shards[(unsigned)cpu % sharded->count];
+    }
+#endif
+    if (!shard_ticket) {
+        shard_ticket = __atomic_add_fetch(&shard_tickets, 1, __ATOMIC_RELAXED);
+    }
+    return sharded->shards[(shard_ticket - 1) % sharded->count];
+}
+
+/**
+ * Returns the shard holding ptr, found from its address alone, or NULL if
+ * ptr is not in the sharded pool.
+ */
+MagicPool* magic_sharded_pool_owner(MagicShardedPool* sharded, void* ptr) {
+    if ((char*)ptr < sharded->base) return NULL;
+    size_t index = (size_t)((char*)ptr - sharded->base) / sharded->shard_size;
+    return index < sharded->count ? sharded->shards[index] : NULL;
+}
+
+/**
+ * Allocates from the calling thread's shard, or from the others in turn if
+ * it is full, so the whole reservation stays usable.
+ */
+void* magic_sharded_pool_malloc(MagicShardedPool* sharded, size_t size) {
+    MagicPool* local = magic_sharded_pool_local(sharded);
+    void* ptr = magic_pool_malloc(local, size);
+    for (unsigned i = 0; !ptr && size && i < sharded->count; i++) {
+        if (sharded->shards[i] != local) {
+            ptr = magic_pool_malloc(sharded->shards[i], size);
+        }
     }
-    block_to_free->free = 1;
+    return ptr;
+}
 
-    if (free_list == NULL) {
-        free_list = block_to_free;
-        free_list->next = NULL;
+/**
+ * Frees ptr to the shard that holds it, whichever thread calls.
+ */
+void magic_sharded_pool_free(MagicShardedPool* sharded, void* ptr) {
+    if (!ptr) return;
+    MagicPool* owner = magic_sharded_pool_owner(sharded, ptr);
+    if (!owner) {
+        REPORT_ERROR(NULL, MAGIC_ERROR_INVALID_POINTER, ptr, 0);
         return;
     }
+    magic_pool_free(owner, ptr);
+}
+
+/**
+ * Resizes ptr within its shard, moving it to another shard only when its own
+ * cannot hold the new size.
+ */
+void* magic_sharded_pool_realloc(MagicShardedPool* sharded, void* ptr, size_t new_size) {
+    if (!ptr) return magic_sharded_pool_malloc(sharded, new_size);
+    MagicPool* owner = magic_sharded_pool_owner(sharded, ptr);
+    if (!owner) {
+        REPORT_ERROR(NULL, MAGIC_ERROR_INVALID_POINTER, ptr, new_size);
+        return NULL;
+    }
+    void* new_ptr = magic_pool_realloc(owner, ptr, new_size);
+    if (!new_ptr && new_size) {
+        new_ptr = magic_sharded_pool_malloc(sharded, new_size);
+        if (new_ptr) {
+            size_t old_size = magic_usable_size(ptr);
+            memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+            magic_pool_free(owner, ptr);
+        }
+    }
+    return new_ptr;
+}
+
+/// ------------------------------- SLABS ------------------------------- //
 
-    insert_block(block_to_free);
+// A slab is a SLAB_BYTES aligned block of the cache's pool: a Slab header,
+// the free stack links of its objects, then the objects. An object's id is
+// the slab's number, counted in SLAB_BYTES from the cache's origin, above
+// its index in the slab. Slabs go back to the pool only when the cache is
+// destroyed, so a stale id read by a losing pop still names live memory.
 
-    //ptr = NULL;
+#define SLAB_SHIFT 16
+#define SLAB_BYTES ((size_t)1 << SLAB_SHIFT)
+#define SLAB_INDEX_BITS 13                                  // SLAB_BYTES / 8 objects at most
+#define SLAB_INDEX_MASK ((1u << SLAB_INDEX_BITS) - 1)
+#define SLAB_MAX_NUMBER ((size_t)1 << (32 - SLAB_INDEX_BITS))
+#define SLAB_MIN_OBJECTS 8
+
+typedef struct Slab {
+    MagicSlabCache* cache;
+    struct Slab* older;         // slab made before this one
+    char* objects;
+    uint32_t next[];            // id of the free object below each free one, 0 at the bottom
+} Slab;
+
+static Slab* slab_of_id(MagicSlabCache* cache, uint32_t id) {
+    return (Slab*)(cache->origin + ((size_t)(id >> SLAB_INDEX_BITS) << SLAB_SHIFT));
+}
+
+static uint32_t slab_id(MagicSlabCache* cache, Slab* slab, uint32_t index) {
+    return (uint32_t)(((char*)slab - cache->origin) >> SLAB_SHIFT) << SLAB_INDEX_BITS | index;
 }
 
+// Index of an object within its slab; the reciprocal is exact for offsets
+// and sizes below 2^16.
+static uint32_t slab_index(MagicSlabCache* cache, Slab* slab, void* ptr) {
+    return (uint32_t)(((uint64_t)((char*)ptr - slab->objects) * cache->reciprocal) >> 32);
+}
 
-Block* find_free_block(size_t size) {
-    Block* current = free_list;
-    while (current && (current->size < size)){
-        current = current->next;
+static void* slab_pop(MagicSlabCache* cache) {
+    uint64_t head = __atomic_load_n(&cache->head, __ATOMIC_ACQUIRE);
+    while ((uint32_t)head) {
+        uint32_t id = (uint32_t)head;
+        Slab* slab = slab_of_id(cache, id);
+        uint32_t next = __atomic_load_n(&slab->next[id & SLAB_INDEX_MASK], __ATOMIC_RELAXED);
+        uint64_t popped = ((head >> 32) + 1) << 32 | next;
+        if (__atomic_compare_exchange_n(&cache->head, &head, popped, 1, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+            return slab->objects + (size_t)(id & SLAB_INDEX_MASK) * cache->object_size;
+        }
     }
-    return current; // NULL if no block is found
+    return NULL;
 }
 
-void split_free_block(Block *current, size_t size){
-    Block* new_block = (Block*)((char*)current + size + BLOCK_SIZE);
-    new_block->size = current->size - size - BLOCK_SIZE; 
-    new_block->free = 1;
-    new_block->next = current->next;
+// Pushes a chain of free objects already linked from first down to last.
+static void slab_push(MagicSlabCache* cache, uint32_t first, Slab* last_slab, uint32_t last) {
+    uint64_t head = __atomic_load_n(&cache->head, __ATOMIC_RELAXED);
+    uint64_t pushed;
+    do {
+        __atomic_store_n(&last_slab->next[last & SLAB_INDEX_MASK], (uint32_t)head, __ATOMIC_RELAXED);
+        pushed = ((head >> 32) + 1) << 32 | first;
+    } while (!__atomic_compare_exchange_n(&cache->head, &head, pushed, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
 
-    current->size = size;
-    current->free = 0;
-    current->next = new_block;
+// Takes a new slab from the pool, keeping its first object for the caller
+// and pushing the rest. One thread grows at a time; the others wait and
+// then take what it pushed.
+static void* slab_grow(MagicSlabCache* cache) {
+    pthread_mutex_lock(&cache->grow_lock);
+    void* ptr = slab_pop(cache);
+    Slab* slab = ptr ? NULL : magic_pool_memalign(cache->pool, SLAB_BYTES, SLAB_BYTES);
+    if (slab && (size_t)((char*)slab - cache->origin) >> SLAB_SHIFT >= SLAB_MAX_NUMBER) {
+        magic_pool_free(cache->pool, slab);     // beyond what an id can number
+        slab = NULL;
+    }
+    if (slab) {
+        slab->cache = cache;
+        slab->older = cache->slabs;
+        slab->objects = (char*)slab + ALIGN(sizeof(Slab) + cache->slab_objects * sizeof(uint32_t));
+        cache->slabs = slab;
+        cache->slab_count++;
+
+        uint32_t first = slab_id(cache, slab, 0);
+        for (uint32_t i = 1; i + 1 < cache->slab_objects; i++) {
+            __atomic_store_n(&slab->next[i], first + i + 1, __ATOMIC_RELAXED);
+        }
+        slab_push(cache, first + 1, slab, first + cache->slab_objects - 1);
+        ptr = slab->objects;
+    }
+    pthread_mutex_unlock(&cache->grow_lock);
+    return ptr;
+}
+
+#if CHECKED
+// Whether ptr is an object of one of cache's slabs. The address is checked
+// against the pool before the slab header it implies is read.
+static int slab_owns(MagicSlabCache* cache, void* ptr) {
+    MagicPool* pool = cache->pool;
+    Slab* slab = (Slab*)((uintptr_t)ptr & ~(uintptr_t)(SLAB_BYTES - 1));
+    if ((char*)slab < pool->base || (char*)ptr >= pool->base + pool->size) return 0;
+    if (slab->cache != cache || (char*)ptr < slab->objects) return 0;
+    uint32_t index = slab_index(cache, slab, ptr);
+    return index < cache->slab_objects && slab->objects + (size_t)index * cache->object_size == (char*)ptr;
 }
+#endif
+
 /**
- * Allocates memory of the specified size.
- * If the allocation is successful, returns a pointer to the allocated memory.
- * If the allocation fails, prints an error message and returns NULL.
- *
- * @param size The size of the memory to allocate.
- * @return A pointer to the allocated memory or NULL if the allocation fails.
+ * Creates a cache of objects of object_size bytes, whose slabs are taken
+ * from pool, or from the default pool if pool is NULL. Objects are aligned
+ * like magic_malloc's blocks and sizes up to about 8 KiB are supported.
+ * Returns NULL for other sizes or if the cache cannot be allocated.
  */
-void* magic_malloc(size_t size) {
-    if (size <= 0 || size > MEMORY_POOL_SIZE - BLOCK_SIZE) {
-        printf("Error: Allocated invalid number of Bytes\n");
+MagicSlabCache* magic_slab_create(MagicPool* pool, size_t object_size) {
+    if (!pool) {
+        pool = magic_default_pool();
+    }
+    size_t size = ALIGN(object_size);
+    uint32_t objects = size ? (uint32_t)((SLAB_BYTES - sizeof(Slab)) / (size + sizeof(uint32_t))) : 0;
+    while (objects && ALIGN(sizeof(Slab) + objects * sizeof(uint32_t)) + objects * size > SLAB_BYTES) {
+        objects--;
+    }
+    if (object_size == 0 || objects < SLAB_MIN_OBJECTS) {
+        REPORT_ERROR(pool, MAGIC_ERROR_INVALID_SIZE, NULL, object_size);
         return NULL;
     }
 
-    size = ALIGN(size);
-    Block* prev = NULL;
-    Block* current = free_list;
+    MagicSlabCache* cache = magic_pool_malloc(pool, sizeof(MagicSlabCache));
+    if (!cache) return NULL;
+    cache->pool = pool;
+    cache->object_size = size;
+    cache->slab_objects = objects;
+    cache->reciprocal = (uint32_t)(((uint64_t)1 << 32) / size + 1);
+    cache->origin = (char*)((uintptr_t)pool->base & ~(uintptr_t)(SLAB_BYTES - 1)) - SLAB_BYTES;    // no id is 0
+    cache->head = 0;
+    cache->slabs = NULL;
+    cache->slab_count = 0;
+    pthread_mutex_init(&cache->grow_lock, NULL);
+    return cache;
+}
+
+/**
+ * Allocates an object from a slab cache. Lock-free unless every slab is
+ * full, when a new slab is taken from the pool. Safe from any thread.
+ * Returns NULL if the pool cannot supply a slab.
+ */
+void* magic_slab_alloc(MagicSlabCache* cache) {
+    void* ptr = slab_pop(cache);
+    return ptr ? ptr : slab_grow(cache);
+}
+
+/**
+ * Returns an object to its slab cache, from any thread. Checked builds
+ * reject pointers that are not objects of the cache; double frees are not
+ * detected.
+ */
+void magic_slab_free(MagicSlabCache* cache, void* ptr) {
+    if (!ptr) return;
+#if CHECKED
+    if (!slab_owns(cache, ptr)) {
+        REPORT_ERROR(cache->pool, MAGIC_ERROR_INVALID_POINTER, ptr, cache->object_size);
+        return;
+    }
+#endif
+    Slab* slab = (Slab*)((uintptr_t)ptr & ~(uintptr_t)(SLAB_BYTES - 1));
+    uint32_t id = slab_id(cache, slab, slab_index(cache, slab, ptr));
+    slab_push(cache, id, slab, id);
+}
 
-    while (current && (current->size < size)) {     // Find a free block and keep track of the previous node
-        prev = current;
-        current = current->next;
+/**
+ * Destroys a slab cache, giving its slabs back to the pool. Every object it
+ * handed out becomes invalid; no other thread may be using the cache.
+ */
+void magic_slab_destroy(MagicSlabCache* cache) {
+    if (!cache) return;
+    while (cache->slabs) {
+        Slab* slab = cache->slabs;
+        cache->slabs = slab->older;
+        magic_pool_free(cache->pool, slab);
     }
-    
-    if (!current) {
-        printf("Error: Memory allocation of %zu bytes failed. No suitable free block found.\n", size);
+    pthread_mutex_destroy(&cache->grow_lock);
+    magic_pool_free(cache->pool, cache);
+}
+
+/// ------------------------------- PERSISTENT POOLS ------------------------------- //
+
+// A persistent pool lives in a file mapped MAP_SHARED: a PersistentHeader,
+// then the pool descriptor and its blocks, laid out as pool_place lays out
+// any region. Free list links, the fit tree and the root are offsets already,
+// so only the descriptor's few pointers (base, tlsf, fast) depend on where
+// the file is mapped; opening the file moves them by the distance from the
+// address it was last mapped at, then validates the whole heap.
+
+#define PERSIST_MAGIC 0x3150414548474dull   // "MGHEAP1"
+#define PERSIST_HEADER_SIZE ((size_t)64)     // the pool starts this far into the file
+
+typedef struct PersistentHeader {
+    uint64_t magic;
+    uint32_t alignment;         // MAGIC_ALIGNMENT of the build that made the file
+    uint32_t descriptor_size;   // sizeof(MagicPool) of that build
+    uint64_t size;              // bytes in the file
+    uint64_t mapped_at;         // address the file was last mapped at
+    uint64_t open;              // nonzero while a process has the pool open; still set if it was not closed cleanly
+} PersistentHeader;
+
+static void persistent_close(MagicPool* pool) {
+#ifndef _WIN32
+    PersistentHeader* header = (PersistentHeader*)pool->file;
+    size_t size = header->size;
+    int fd = pool->file_fd;
+    header->open = 0;
+    msync(header, size, MS_SYNC);
+    munmap(header, size);
+    close(fd);                  // releases the file lock
+#else
+    (void)pool;
+#endif
+}
+
+// Moves the descriptor's pointers from the address the file was last mapped
+// at to file, where this process maps it.
+static void persistent_rebase(MagicPool* pool, char* file) {
+    PersistentHeader* header = (PersistentHeader*)file;
+    char* old_file = (char*)(uintptr_t)header->mapped_at;
+    pool->base = file + (pool->base - old_file);
+    if (pool->tlsf) {
+        pool->tlsf = (TlsfIndex*)(file + ((char*)pool->tlsf - old_file));
+    }
+    if (pool->fast) {
+        pool->fast = (uint32_t*)(file + ((char*)pool->fast - old_file));
+    }
+    header->mapped_at = (uint64_t)(uintptr_t)file;
+}
+
+#ifndef _WIN32
+// Rebases and validates the pool in a file written by an earlier process.
+static MagicPool* persistent_attach(char* file, size_t size) {
+    PersistentHeader* header = (PersistentHeader*)file;
+    if (size < PERSIST_HEADER_SIZE + sizeof(MagicPool) || header->magic != PERSIST_MAGIC ||
+        header->alignment != ALIGNMENT || header->descriptor_size != sizeof(MagicPool) || header->size != size) {
         return NULL;
     }
 
-    if (current->size > size + BLOCK_SIZE) {// split block and create new free block
-        split_free_block(current,size);
+    // Pointers are checked against the old mapping before they are moved to the new one
+    MagicPool* pool = (MagicPool*)(file + PERSIST_HEADER_SIZE);
+    char* old_file = (char*)(uintptr_t)header->mapped_at;
+    size_t base = (size_t)(pool->base - old_file);
+    // Persistent pools are only ever created segregated, so nothing else is accepted
+    if (base < PERSIST_HEADER_SIZE + sizeof(MagicPool) || base > size || base % ALIGNMENT || pool->size > size - base ||
+        pool->mode != MAGIC_MODE_SEGREGATED || pool->tlsf || (unsigned)pool->fit > MAGIC_FIT_BEST || pool->large || pool->max_size) {
+        return NULL;
     }
-    else {// available memory is exact size of requrested or not enough for a new block 
-        current->free = 0;
+    size_t fast = (size_t)((char*)pool->fast - old_file);
+    if (pool->fast && (fast < base || fast % sizeof(uint32_t) || fast + FAST_BIN_COUNT * sizeof(uint32_t) > base + pool->size)) {
+        return NULL;
     }
+    if (pool->root && pool->root - 1 >= pool->size) return NULL;
+    pool->rover = 0;            // only a hint for next fit, not worth validating
+    persistent_rebase(pool, file);
+    pthread_mutex_init(&pool->lock, NULL);
+    return pool_check(pool) == MAGIC_OK ? pool : NULL;
+}
+#endif
 
-    // remove allocated block from free_list
-    if (prev) {
-        prev->next = current->next;
-    } 
+/**
+ * Opens the persistent pool in the file at path, or creates a file of size
+ * bytes holding an empty one if it does not exist. Pointers into the pool
+ * change from one run to the next; find data again through the root object.
+ * An existing file is only accepted if its whole heap checks out, so a file
+ * left inconsistent by a crash is refused rather than used. A file is open
+ * in one handle at a time: it stays locked until the pool is closed with
+ * magic_pool_destroy.
+ *
+ * @param path File holding the heap.
+ * @param size Bytes of a new file; ignored when the file exists.
+ * @return The pool or NULL if the file cannot be created or mapped, is open
+ *         already, was made by an incompatible build, or fails the heap check.
+ */
+MagicPool* magic_pool_open_file(const char* path, size_t size) {
+#ifdef _WIN32
+    (void)path; (void)size;
+    printf("Error: Persistent pools are not supported on this platform\n");
+    return NULL;
+#else
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        printf("Error: Could not open heap file %s\n", path);
+        if (fd >= 0) close(fd);
+        return NULL;
+    }
+    // Attaching would reinitialise the lock and rebase the descriptor under the other opener
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        printf("Error: Heap file %s is open already\n", path);
+        close(fd);
+        return NULL;
+    }
+    int created = st.st_size == 0;
+    if (created) {
+        size = (size + OS_PAGE_SIZE - 1) & ~(OS_PAGE_SIZE - 1);
+        if (size < PERSIST_HEADER_SIZE + sizeof(MagicPool) + BLOCK_SIZE + MIN_PAYLOAD || ftruncate(fd, (off_t)size) != 0) {
+            printf("Error: Could not create heap file %s of %zu bytes\n", path, size);
+            close(fd);
+            return NULL;
+        }
+    }
+    else size = (size_t)st.st_size;
+
+    char* file = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (file == MAP_FAILED) {
+        printf("Error: Could not map heap file %s\n", path);
+        close(fd);
+        if (created) unlink(path);
+        return NULL;
+    }
+
+    PersistentHeader* header = (PersistentHeader*)file;
+    MagicPool* pool;
+    if (created) {
+        pool = pool_place(file + PERSIST_HEADER_SIZE, size - PERSIST_HEADER_SIZE, 0, MAGIC_MODE_SEGREGATED);
+        if (!pool) {
+            munmap(file, size);
+            close(fd);
+            unlink(path);
+            return NULL;
+        }
+        pool->fresh = 0;        // a new file reads as zeros
+        header->magic = PERSIST_MAGIC;
+        header->alignment = ALIGNMENT;
+        header->descriptor_size = sizeof(MagicPool);
+        header->size = size;
+    }
     else {
-        free_list = current->next;
+        pool = persistent_attach(file, size);
+        if (!pool) {
+            close(fd);
+            printf("Error: Heap file %s is damaged or was made by an incompatible build\n", path);
+            munmap(file, size);
+            return NULL;
+        }
     }
-    return(void*)(current + 1);
+    pool->file = file;
+    pool->file_fd = fd;
+    header->mapped_at = (uint64_t)(uintptr_t)file;
+    header->open = 1;
+    return pool;
+#endif
 }
 
-void* magic_calloc(size_t num, size_t size)
-{
-    size_t total_size = num * size;
-    void* ptr = magic_malloc(total_size);
-    if (ptr) memset(ptr, 0, total_size);    
-    return ptr;
+/**
+ * Writes a persistent pool's heap to its file. Returns 0 on success, -1 on
+ * failure or for pools that are not persistent.
+ */
+int magic_pool_sync(MagicPool* pool) {
+#ifdef _WIN32
+    (void)pool;
+    return -1;
+#else
+    if (!pool->file) return -1;
+    pthread_mutex_lock(&pool->lock);
+    int result = msync(pool->file, ((PersistentHeader*)pool->file)->size, MS_SYNC);
+    pthread_mutex_unlock(&pool->lock);
+    return result == 0 ? 0 : -1;
+#endif
 }
 
-void* magic_realloc(void* ptr, size_t new_size)
-{
-    if (!ptr) return magic_malloc(new_size);
+/**
+ * Records ptr, a block of pool, as the pool's root object, or clears the
+ * root if ptr is NULL. The root is stored as an offset, so a persistent pool
+ * reopened at another address still finds it.
+ */
+void magic_pool_set_root(MagicPool* pool, void* ptr) {
+#if CHECKED
+    MagicError error = ptr ? check_pointer(pool, ptr, 0) : MAGIC_OK;
+    if (error) {
+        REPORT_ERROR(pool, error, ptr, 0);
+        return;
+    }
+#endif
+    pool->root = ptr ? (size_t)((char*)ptr - pool->base) + 1 : 0;
+}
 
-    Block* current_block = (Block*)ptr - 1; // Block pointer
-    if (current_block->free) {
-        return magic_malloc(new_size);
+/**
+ * Returns the pool's root object, or NULL if none was set.
+ */
+void* magic_pool_root(MagicPool* pool) {
+    return pool->root ? pool->base + pool->root - 1 : NULL;
+}
+
+/// ------------------------------- SHARED POOLS ------------------------------- //
+
+// A shared pool is laid out like a persistent pool, but in a POSIX shared
+// memory object that several processes map at once, each at an address of
+// its own. The descriptor's pointers can only match one mapping at a time, so
+// every call takes the process-shared lock and, if another process used the
+// pool last, first rebases them to the caller's mapping. Blocks, their links
+// and the free lists are offsets and never move.
+
+#define SHARED_MAGIC 0x314d48534741ull    // "AGSHM1"
+
+#ifndef _WIN32
+// Takes a shared pool's lock and points its descriptor at this process's
+// mapping. A process that died holding the lock may have left the heap half
+// updated, so the pool is only used again if the whole heap checks out.
+static int shared_lock(MagicSharedPool* shared) {
+    MagicPool* pool = shared->pool;
+    int result = pthread_mutex_lock(&pool->lock);
+    if (result != 0 && result != EOWNERDEAD) return -1;
+    if (((PersistentHeader*)shared->region)->mapped_at != (uintptr_t)shared->region) {
+        persistent_rebase(pool, shared->region);
+    }
+    if (result == EOWNERDEAD) {
+        if (pool_check(pool) != MAGIC_OK) {
+            printf("Error: A process died while changing a shared pool and left it damaged\n");
+            pthread_mutex_unlock(&pool->lock);      // the lock stays unrecoverable
+            return -1;
+        }
+        pthread_mutex_consistent(&pool->lock);
+    }
+    return 0;
+}
+
+// Maps the shared memory object open as fd and maps this process's handle
+// next to it, so the handle lives exactly as long as the mapping and does not
+// depend on any pool of this process.
+static MagicSharedPool* shared_map(int fd, size_t size) {
+    MagicSharedPool* shared = os_reserve(sizeof(MagicSharedPool));
+    char* region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (!shared || region == MAP_FAILED) {
+        if (shared) os_release(shared, sizeof(MagicSharedPool));
+        if (region != MAP_FAILED) munmap(region, size);
+        return NULL;
     }
+    shared->pool = (MagicPool*)(region + PERSIST_HEADER_SIZE);
+    shared->region = region;
+    shared->size = size;
+    return shared;
+}
 
-    if (new_size <= 0) {
-        magic_free(ptr);
+static void shared_unmap(MagicSharedPool* shared) {
+    munmap(shared->region, shared->size);
+    os_release(shared, sizeof(MagicSharedPool));
+}
+#endif
+
+/**
+ * Creates a pool of size bytes in a new POSIX shared memory object called
+ * name ("/something"), for other processes to magic_shared_pool_attach.
+ * A process allocates a block, passes magic_shared_pool_offset of it to
+ * another, which turns it back into a pointer with magic_shared_pool_pointer
+ * and may free it: messages change hands without being copied.
+ *
+ * @return This process's handle or NULL if the object already exists or
+ *         cannot be created.
+ */
+MagicSharedPool* magic_shared_pool_create(const char* name, size_t size) {
+#ifdef _WIN32
+    (void)name; (void)size;
+    printf("Error: Shared pools are not supported on this platform\n");
+    return NULL;
+#else
+    size = (size + OS_PAGE_SIZE - 1) & ~(OS_PAGE_SIZE - 1);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        printf("Error: Could not create shared memory %s\n", name);
+        return NULL;
+    }
+    MagicSharedPool* shared = NULL;
+    if (size >= PERSIST_HEADER_SIZE + sizeof(MagicPool) + BLOCK_SIZE + MIN_PAYLOAD && ftruncate(fd, (off_t)size) == 0) {
+        shared = shared_map(fd, size);
+    }
+    else close(fd);
+    if (!shared) {
+        printf("Error: Could not create shared pool %s of %zu bytes\n", name, size);
+        shm_unlink(name);
         return NULL;
     }
 
-    size_t current_size = current_block->size;
-    if (new_size <= current_size) return ptr;
+    MagicPool* pool = pool_place(shared->pool, size - PERSIST_HEADER_SIZE, 0, MAGIC_MODE_SEGREGATED);
+    if (!pool) {
+        shared_unmap(shared);
+        shm_unlink(name);
+        return NULL;
+    }
+    pool->fresh = 0;            // new shared memory reads as zeros
+    pthread_mutexattr_t attributes;
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_mutex_init(&pool->lock, &attributes);
+    pthread_mutexattr_destroy(&attributes);
 
-    // Block* next_block = current_block->next;
-    // if (next_block && next_block->free && (current_size + sizeof(Block) + next_block->size) >= new_size) {  // check if right adjacent block can accomodate new size
-    //     // Merge the current block with the next free block
-    //     current_block->size += sizeof(Block) + next_block->size;
-    //     current_block->next = next_block->next;
-    //     return ptr;  // No need to copy, memory is already expanded
-    // }
+    PersistentHeader* header = (PersistentHeader*)shared->region;
+    header->alignment = ALIGNMENT;
+    header->descriptor_size = sizeof(MagicPool);
+    header->size = size;
+    header->mapped_at = (uint64_t)(uintptr_t)shared->region;
+    header->open = 1;
+    __atomic_store_n(&header->magic, SHARED_MAGIC, __ATOMIC_RELEASE);
+    return shared;
+#endif
+}
 
-    magic_free(ptr);
-    void* new_ptr = magic_malloc(new_size);
-    memcpy(new_ptr,ptr,new_size);
-    return new_ptr;
+/**
+ * Attaches this process to the shared pool called name. The shared memory
+ * is mapped wherever the OS places it; the pool works regardless.
+ *
+ * @return This process's handle or NULL if there is no such pool or it was
+ *         made by an incompatible build.
+ */
+MagicSharedPool* magic_shared_pool_attach(const char* name) {
+#ifdef _WIN32
+    (void)name;
+    printf("Error: Shared pools are not supported on this platform\n");
+    return NULL;
+#else
+    int fd = shm_open(name, O_RDWR, 0);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < PERSIST_HEADER_SIZE + sizeof(MagicPool)) {
+        printf("Error: Could not open shared pool %s\n", name);
+        if (fd >= 0) close(fd);
+        return NULL;
+    }
+    MagicSharedPool* shared = shared_map(fd, (size_t)st.st_size);
+    PersistentHeader* header = shared ? (PersistentHeader*)shared->region : NULL;
+    if (!header || __atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != SHARED_MAGIC ||
+        header->alignment != ALIGNMENT || header->descriptor_size != sizeof(MagicPool) || header->size != shared->size) {
+        printf("Error: %s is not a shared pool of this build\n", name);
+        if (shared) shared_unmap(shared);
+        return NULL;
+    }
+    __atomic_fetch_add(&header->open, 1, __ATOMIC_RELAXED);
+    return shared;
+#endif
 }
 
 /**
- * Prints the current state of the memory pool.
- * Displays metadata and whether each block is allocated or free.
+ * Unmaps a shared pool from this process and frees the handle. Blocks the
+ * process allocated stay allocated; the pool lives on until it is unlinked
+ * and every process has detached.
  */
-void visualize_memory_pool()
-{
-    Block* current = (Block*)memory_pool;
-    int blockIndex = 0;
+void magic_shared_pool_detach(MagicSharedPool* shared) {
+#ifndef _WIN32
+    __atomic_fetch_sub(&((PersistentHeader*)shared->region)->open, 1, __ATOMIC_RELAXED);
+    shared_unmap(shared);
+#else
+    (void)shared;
+#endif
+}
 
-    printf("\n[Memory Pool Visualization]\n");
-    printf("Pool Size: %d bytes\n\n", MEMORY_POOL_SIZE);
+/**
+ * Removes the name of a shared pool, so no process can attach to it any more.
+ * Processes already attached keep using it. Returns 0 on success, -1 if
+ * there is no such pool.
+ */
+int magic_shared_pool_unlink(const char* name) {
+#ifdef _WIN32
+    (void)name;
+    return -1;
+#else
+    return shm_unlink(name) == 0 ? 0 : -1;
+#endif
+}
 
-    while ((char*)current < memory_pool + MEMORY_POOL_SIZE) {
-        // Masking the address to fit into 9 digits
-        uintptr_t startAddress = (uintptr_t)current % 1000000000;
-        uintptr_t dataStart = ((uintptr_t)current + BLOCK_SIZE) % 1000000000;
-        uintptr_t dataEnd = (dataStart + current->size - 1) % 1000000000;
-        //uintptr_t nextAddress = current->next ? ((uintptr_t)current->next % 1000000000) : 0;
+/**
+ * Allocates size bytes from a shared pool, like magic_pool_malloc.
+ */
+void* magic_shared_pool_malloc(MagicSharedPool* shared, size_t size) {
+#ifdef _WIN32
+    (void)shared; (void)size;
+    return NULL;
+#else
+    MagicPool* pool = shared->pool;
+    if (shared_lock(shared) != 0) return NULL;
+    void* ptr = pool_malloc(pool, size);
+    if (ptr) stats_count(&pool->stats.allocations, 1);
+    DEBUG_CHECK(pool);
+    pthread_mutex_unlock(&pool->lock);
+    return ptr;
+#endif
+}
 
-        printf("Block %d:\n", blockIndex++);
-        printf("  Start Address: %09lu\n", startAddress);
-        printf("  Block Size: %zu bytes\n", current->size + BLOCK_SIZE);
-        printf("  Allocated: %s\n", current->free ? "NO (Free)" : "YES (Allocated)");
-        printf("  Data Range: [%09lu - %09lu] (%zu bytes)\n", dataStart, dataEnd, current->size);
-        ///printf("  Next Block Address: %09lu\n", nextAddress);
+/**
+ * Frees a block of a shared pool, whichever process allocated it.
+ * Checked builds report NULL, foreign and already freed pointers.
+ */
+void magic_shared_pool_free(MagicSharedPool* shared, void* ptr) {
+#ifndef _WIN32
+    MagicPool* pool = shared->pool;
+    if (!ptr) {
+        REPORT_ERROR(pool, MAGIC_ERROR_NULL_FREE, ptr, 0);
+        return;
+    }
+    if (shared_lock(shared) != 0) return;
+#if CHECKED
+    MagicError error = check_pointer(pool, ptr, 0);
+    if (!error && pool->fast && fast_holds(pool, (Block*)ptr - 1)) {
+        error = MAGIC_ERROR_DOUBLE_FREE;
+    }
+    if (error) {
+        pthread_mutex_unlock(&pool->lock);
+        REPORT_ERROR(pool, error, ptr, 0);
+        return;
+    }
+#endif
+    pool_free(pool, ptr);
+    stats_count(&pool->stats.frees, 1);
+    DEBUG_CHECK(pool);
+    pthread_mutex_unlock(&pool->lock);
+#else
+    (void)shared; (void)ptr;
+#endif
+}
 
-        // Move to the next block
-        current = (Block*)((char*)current + BLOCK_SIZE + current->size);
-        printf("\n");
+/**
+ * Returns the offset of ptr, a block of the shared pool, to hand to another
+ * process, or 0 for NULL.
+ */
+size_t magic_shared_pool_offset(MagicSharedPool* shared, void* ptr) {
+    return ptr ? (size_t)((char*)ptr - shared->region) : 0;
+}
+
+/**
+ * Returns the pointer in this process's mapping of a block whose offset came
+ * from magic_shared_pool_offset in any process, or NULL for offset 0.
+ */
+void* magic_shared_pool_pointer(MagicSharedPool* shared, size_t offset) {
+#if CHECKED
+    if (offset >= shared->size) {
+        REPORT_ERROR(shared->pool, MAGIC_ERROR_INVALID_POINTER, NULL, offset);
+        return NULL;
     }
+#endif
+    return offset ? shared->region + offset : NULL;
+}
+
+/**
+ * Validates a shared pool's heap like magic_pool_check. Use this rather than
+ * magic_pool_check on shared->pool, whose pointers may be set up for another
+ * process's mapping.
+ */
+MagicError magic_shared_pool_check(MagicSharedPool* shared) {
+#ifdef _WIN32
+    (void)shared;
+    return MAGIC_OK;
+#else
+    if (shared_lock(shared) != 0) return MAGIC_ERROR_CORRUPTION;
+    MagicError error = pool_check(shared->pool);
+    pthread_mutex_unlock(&shared->pool->lock);
+    return error;
+#endif
 }
 
+// Builds that link the allocator into another program (the benchmark)
+// define MAGIC_NO_MAIN to leave out the test runner.
+#ifndef MAGIC_NO_MAIN
 int main () 
 {
     run_all_tests();
     run_coalesing_tests();
+    run_pool_tests();
+    run_size_class_tests();
+    run_tlsf_tests();
+    run_thread_tests();
+    run_realloc_tests();
+    run_buddy_tests();
+    run_trace_tests();
+    run_stats_tests();
+    run_check_tests();
+    run_alignment_tests();
+    run_batch_tests();
+    run_growth_tests();
+    run_large_block_tests();
+    run_purge_tests();
+    run_fit_tests();
+    run_arena_tests();
+    run_shard_tests();
+    run_slab_tests();
+    run_fast_bin_tests();
+    run_persist_tests();
+    run_shared_pool_tests();
+    run_calloc_tests();
     run_performace_tests();
 
     return 0;
-}
\ No newline at end of file
+}
+#endif // MAGIC_NO_MAIN
@@ -2,20 +2,255 @@
 #define MAIN_H
 
 #include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+// Build-time checking, chosen with -DMAGIC_CHECK_LEVEL=n:
+//   MAGIC_CHECK_RELEASE  no validation and no stdio on the allocation paths
+//   MAGIC_CHECK_CHECKED  cheap pointer/header validation, errors reported through
+//                        magic_last_error and the error handler (default)
+//   MAGIC_CHECK_DEBUG    also validates the whole heap after every locked operation
+//                        and prints errors when no handler is set
+#define MAGIC_CHECK_RELEASE 0
+#define MAGIC_CHECK_CHECKED 1
+#define MAGIC_CHECK_DEBUG 2
+#ifndef MAGIC_CHECK_LEVEL
+#define MAGIC_CHECK_LEVEL MAGIC_CHECK_CHECKED
+#endif
+
+// Payload alignment. The default of 8 keeps headers to one word; building
+// with -DMAGIC_ALIGNMENT=16 pads headers to 16 bytes so every payload meets
+// the alignment malloc guarantees on x86-64 and AArch64 (see libmagic.so).
+#ifndef MAGIC_ALIGNMENT
+#define MAGIC_ALIGNMENT 8
+#endif
 
 // Structure Definitions
+// Every block starts with a one word header holding its payload size. Sizes
+// are multiples of MAGIC_ALIGNMENT, so the low three bits of the word carry flags.
 typedef struct Block {
-    size_t size;
-    int free;
-    struct Block* next;
+    size_t header;              // payload size | BLOCK_FREE | BLOCK_PREV_FREE
+#if MAGIC_ALIGNMENT > 8
+    char padding[MAGIC_ALIGNMENT - sizeof(size_t)];
+#endif
 } Block;
 
+#define BLOCK_FREE 0x1          // block is in the pool's free index
+#define BLOCK_PREV_FREE 0x2     // physical left neighbour is free and ends in a boundary tag
+#define BLOCK_MMAPPED 0x4       // block has an OS mapping of its own, outside the pool region
+#define BLOCK_FLAGS 0x7
+
+#define GET_SIZE(block) ((block)->header & ~(size_t)BLOCK_FLAGS)
+#define IS_FREE(block) (((block)->header & BLOCK_FREE) != 0)
+#define IS_MMAPPED(block) (((block)->header & BLOCK_MMAPPED) != 0)
+#define PREV_IS_FREE(block) (((block)->header & BLOCK_PREV_FREE) != 0)
+
+// Only a free block links into its size class, using the start of its payload.
+// Links are 32-bit offsets into the pool rather than pointers, so together
+// with the boundary tag in the last payload word a free block needs just
+// MIN_PAYLOAD bytes.
+typedef struct FreeLinks {
+    uint32_t next;
+    uint32_t prev;
+} FreeLinks;
+
+#define MIN_PAYLOAD (sizeof(FreeLinks) + sizeof(size_t))
+
+#define BIN_COUNT 64            // size classes, one bit each in MagicPool.bin_bitmap
+#define FAST_BIN_COUNT 32       // fast bins, one per size up to FAST_BIN_COUNT * MAGIC_ALIGNMENT bytes
+
+// Two-level segregated fit index: one first level per power of two, each
+// split into TLSF_SL_COUNT linear second-level classes.
+#define TLSF_SL_LOG2 4
+#define TLSF_SL_COUNT (1 << TLSF_SL_LOG2)
+#define TLSF_FL_COUNT 48
+#define TLSF_SMALL_LIMIT (TLSF_SL_COUNT * 8)   // sizes below this all sit in first level 0
+
+typedef struct TlsfIndex {
+    uint64_t fl_bitmap;                             // bit fl set when sl_bitmap[fl] != 0
+    uint32_t sl_bitmap[TLSF_FL_COUNT];              // bit sl set when bins[fl][sl] holds a block
+    uint32_t bins[TLSF_FL_COUNT][TLSF_SL_COUNT];    // offsets of the first free block of each class
+} TlsfIndex;
+
+// How a pool indexes its free blocks, chosen when the pool is created.
+typedef enum MagicPoolMode {
+    MAGIC_MODE_SEGREGATED,      // exact small bins plus power of two bins (default)
+    MAGIC_MODE_TLSF,            // two-level segregated fit, O(1) bounded malloc and free
+    MAGIC_MODE_BUDDY,           // binary buddy system for power of two workloads
+} MagicPoolMode;
+
+// Which of the free blocks that fit a segregated pool hands out.
+typedef enum MagicFitPolicy {
+    MAGIC_FIT_FIRST,            // first fit in the request's bin, else the head of the next bin up (default)
+    MAGIC_FIT_NEXT,             // next fit: walks the heap from where the last search ended
+    MAGIC_FIT_BEST,             // best fit: smallest block that fits, lowest address first
+} MagicFitPolicy;
+
+// Heap statistics, maintained as blocks change hands so reading them never
+// walks the heap. Byte counts are payload bytes; blocks held in thread caches
+// count as in use, blocks waiting in fast bins as neither in use nor free.
+typedef struct MagicStats {
+    size_t bytes_in_use;                // payload of allocated blocks
+    size_t peak_bytes_in_use;
+    size_t free_bytes;                  // payload of free blocks
+    size_t largest_free_block;          // payload of a free block in the highest non-empty bin, see README
+    size_t free_blocks;
+    size_t allocations;                 // successful malloc and calloc calls
+    size_t frees;
+    size_t reallocs;
+    size_t failed_allocations;
+    size_t mapped_bytes;                // OS mappings of blocks above the mmap threshold
+    size_t purged_pages;                // pages of free blocks currently handed back to the OS
+    size_t purged_pages_total;          // pages purged since the pool was created
+    size_t size_classes[BIN_COUNT];     // allocated blocks per size class
+} MagicStats;
+
+// A pool is one independent heap: a contiguous region carved into Blocks
+// with its own segregated free lists. Pools never share blocks with each other.
+typedef struct MagicPool {
+    char* base;                 // first Block of the pool
+    size_t size;                // bytes managed, metadata included
+    uint64_t bin_bitmap;        // bit i set when bins[i] holds a free block
+    uint32_t bins[BIN_COUNT];   // offset of the first free block of each size class
+    size_t mapping_size;        // bytes reserved from the OS, 0 if caller owned
+    size_t max_size;            // size a growable pool may reach, 0 if it cannot grow
+    int tail_free;              // last block is free; read when the pool grows
+    size_t mmap_threshold;      // requests of at least this many bytes get their own mapping, 0 for never
+    struct LargeBlock* large;   // blocks with their own mapping, guarded by lock
+    unsigned purge_decay_ms;    // free pages unused this long go back to the OS, 0 for never
+    uint64_t purge_epoch;       // decay epoch new free blocks are stamped with
+    uint64_t purge_deadline;    // CLOCK_MONOTONIC ns at which the epoch ends
+    MagicPoolMode mode;
+    MagicFitPolicy fit;         // placement of MAGIC_MODE_SEGREGATED pools
+    uint32_t tree;              // root of the MAGIC_FIT_BEST tree of large free blocks
+    uint32_t rover;             // free block the next MAGIC_FIT_NEXT search starts at, 0 for the base
+    TlsfIndex* tlsf;            // free block index of MAGIC_MODE_TLSF pools, stored in the region
+    int thread_cache;           // small blocks go through per-thread caches
+    uint32_t* fast;             // newest block of each fast bin, in a block of the pool; NULL while off
+    size_t fast_count;          // blocks waiting in fast bins
+    size_t root;                // offset of the root object's payload from base plus one, 0 for none
+    size_t fresh;               // offset from base past which no block has reached; zero memory there stays zero
+    char* file;                 // start of the file mapping of a persistent pool, NULL otherwise
+    int file_fd;                // descriptor of that file, holding its lock while the pool is open
+    MagicStats stats;           // call counts are atomic, the rest guarded by lock
+    pthread_mutex_t lock;       // guards the blocks and free index
+} MagicPool;
+
+// Arenas hand out memory from chunks of a pool by bumping a pointer and give
+// it all back at once. An arena is not thread safe.
+typedef struct MagicArena {
+    MagicPool* pool;            // chunks are blocks of this pool
+    struct ArenaChunk* chunk;   // chunk being bumped from, linked to the older ones
+    char* next;                 // first unused byte of chunk
+    char* end;                  // end of chunk
+    size_t chunk_size;          // payload of the next chunk, doubled up to ARENA_MAX_CHUNK
+} MagicArena;
+
+// Savepoint of an arena, taken by magic_arena_mark.
+typedef struct MagicArenaMark {
+    struct ArenaChunk* chunk;
+    char* next;
+} MagicArenaMark;
+
+// A sharded pool splits one reservation into independent pools, its shards,
+// so threads take different locks. Blocks are freed to the shard whose
+// slice of the reservation holds them, whichever thread frees them.
+#define MAGIC_MAX_SHARDS 64
+
+typedef enum MagicShardPolicy {
+    MAGIC_SHARD_CPU,            // the shard of the CPU the thread runs on (sched_getcpu)
+    MAGIC_SHARD_THREAD,         // one shard per thread, assigned round-robin
+} MagicShardPolicy;
+
+typedef struct MagicShardedPool {
+    char* base;                 // start of shard 0; shard i starts at base + i * shard_size
+    size_t shard_size;
+    size_t mapping_size;        // bytes reserved, descriptor included
+    unsigned count;
+    MagicShardPolicy policy;
+    MagicPool* shards[MAGIC_MAX_SHARDS];
+} MagicShardedPool;
+
+// A slab cache hands out objects of one size, carved from 64 KiB slabs of a
+// pool, with no per-object header. Free objects form a lock-free stack of
+// object ids; the head carries a generation count against ABA.
+typedef struct MagicSlabCache {
+    MagicPool* pool;            // slabs are blocks of this pool
+    size_t object_size;
+    uint32_t slab_objects;      // objects per slab
+    uint32_t reciprocal;        // 2^32 / object_size rounded up, to divide by multiplying
+    char* origin;               // object ids number slabs in 64 KiB steps from here
+    uint64_t head;              // generation << 32 | id of the first free object, 0 when empty
+    struct Slab* slabs;         // every slab, newest first, guarded by grow_lock
+    size_t slab_count;          // guarded by grow_lock
+    pthread_mutex_t grow_lock;
+} MagicSlabCache;
+
+// A shared pool lives in POSIX shared memory that several processes map at
+// once. Each process works through its own handle, as the mapping's address
+// differs between processes; blocks pass between them as offsets.
+typedef struct MagicSharedPool {
+    MagicPool* pool;            // descriptor inside the shared memory
+    char* region;               // this process's mapping of the shared memory
+    size_t size;                // bytes mapped
+} MagicSharedPool;
+
+// Trace files written by magic_trace_start: a MagicTraceHeader followed by
+// `capacity` records used as a ring. Record i lives in slot i % capacity.
+#define MAGIC_TRACE_MAGIC 0x32454341525447ull  // "GTRACE2"
+
+typedef struct MagicTraceHeader {
+    uint64_t magic;
+    uint64_t capacity;          // record slots in the file
+    uint64_t next;              // records written so far, may exceed capacity
+} MagicTraceHeader;
+
+typedef enum MagicTraceOp {
+    MAGIC_TRACE_MALLOC = 1,
+    MAGIC_TRACE_CALLOC,
+    MAGIC_TRACE_REALLOC,
+    MAGIC_TRACE_FREE,
+    MAGIC_TRACE_MEMALIGN,
+} MagicTraceOp;
+
+// Handles are the block offsets of the pointers involved, 0 for NULL, so the
+// same handle names one allocation until it is freed. Large blocks live in
+// mappings of their own and are named by MAGIC_TRACE_LARGE_ID plus the page
+// number of their mapping instead.
+#define MAGIC_TRACE_LARGE_ID ((uint64_t)1 << 63)
+
+typedef struct MagicTraceRecord {
+    uint64_t timestamp;         // CLOCK_MONOTONIC ns
+    uint64_t op_size;           // op << MAGIC_TRACE_OP_SHIFT | bytes requested
+    uint64_t id;                // handle returned (or freed, for MAGIC_TRACE_FREE)
+    uint64_t old_id;            // handle passed to realloc, log2 of the alignment for memalign
+} MagicTraceRecord;
+
+#define MAGIC_TRACE_OP_SHIFT 56
+#define MAGIC_TRACE_SIZE_MASK (((uint64_t)1 << MAGIC_TRACE_OP_SHIFT) - 1)
+#define MAGIC_TRACE_OP(record) ((int)((record)->op_size >> MAGIC_TRACE_OP_SHIFT))
+#define MAGIC_TRACE_SIZE(record) ((size_t)((record)->op_size & MAGIC_TRACE_SIZE_MASK))
+
+typedef enum MagicError {
+    MAGIC_OK = 0,
+    MAGIC_ERROR_INVALID_SIZE,       // 0 bytes, or more than the pool can ever hold
+    MAGIC_ERROR_OUT_OF_MEMORY,      // no free block fits the request
+    MAGIC_ERROR_NULL_FREE,
+    MAGIC_ERROR_DOUBLE_FREE,
+    MAGIC_ERROR_INVALID_POINTER,    // not a block of this pool, or its header is damaged
+    MAGIC_ERROR_CORRUPTION,         // heap validation found a broken invariant
+    MAGIC_ERROR_INVALID_ALIGNMENT,  // not a power of two, or not supported by the pool mode
+} MagicError;
+
+// Called on every error detected while checks are compiled in. ptr and size
+// are the arguments of the failing call, if any.
+typedef void (*MagicErrorHandler)(MagicPool* pool, MagicError error, void* ptr, size_t size);
+
 // Block size constant
-#define MEMORY_POOL_SIZE 1024 
+#define MEMORY_POOL_SIZE 1024
 #define BLOCK_SIZE sizeof(Block)
 
-extern char memory_pool[MEMORY_POOL_SIZE];          // Simulated Heap
-extern Block* free_list;                            // Head of the free list 
+extern char memory_pool[MEMORY_POOL_SIZE];          // Simulated Heap backing the default pool
 
 // Exposed Function Declarations
 void initialize_memory_pool();
@@ -25,4 +260,92 @@ void* magic_realloc(void* ptr, size_t new_size);
 void magic_free(void* ptr);
 void visualize_memory_pool();
 
+// Bursts of same-sized blocks from the default pool
+size_t magic_malloc_batch(size_t size, size_t n, void** out);
+void magic_free_batch(void** ptrs, size_t n);
+
+// Aligned allocation from the default pool
+void* magic_memalign(size_t alignment, size_t size);
+void* magic_aligned_alloc(size_t alignment, size_t size);
+int magic_posix_memalign(void** memptr, size_t alignment, size_t size);
+
+// Pool API
+MagicPool* magic_pool_create(size_t size);
+MagicPool* magic_pool_from_buffer(void* buffer, size_t size);
+MagicPool* magic_pool_create_mode(size_t size, MagicPoolMode mode);
+MagicPool* magic_pool_from_buffer_mode(void* buffer, size_t size, MagicPoolMode mode);
+MagicPool* magic_pool_create_growable(size_t size, size_t max_size);
+MagicPool* magic_pool_open_file(const char* path, size_t size);
+int magic_pool_sync(MagicPool* pool);
+void magic_pool_set_root(MagicPool* pool, void* ptr);
+void* magic_pool_root(MagicPool* pool);
+void magic_pool_destroy(MagicPool* pool);
+void* magic_pool_malloc(MagicPool* pool, size_t size);
+void* magic_pool_calloc(MagicPool* pool, size_t num, size_t size);
+void* magic_pool_realloc(MagicPool* pool, void* ptr, size_t new_size);
+void magic_pool_free(MagicPool* pool, void* ptr);
+void* magic_pool_memalign(MagicPool* pool, size_t alignment, size_t size);
+size_t magic_pool_malloc_batch(MagicPool* pool, size_t size, size_t n, void** out);
+void magic_pool_free_batch(MagicPool* pool, void** ptrs, size_t n);
+void magic_pool_visualize(MagicPool* pool);
+size_t magic_usable_size(void* ptr);
+
+void magic_pool_set_thread_cache(MagicPool* pool, int enabled);
+void magic_pool_set_mmap_threshold(MagicPool* pool, size_t threshold);
+int magic_pool_set_fit(MagicPool* pool, MagicFitPolicy fit);
+int magic_pool_set_fast_bins(MagicPool* pool, int enabled);
+int magic_pool_owns(MagicPool* pool, void* ptr);
+void magic_pool_set_purge_decay(MagicPool* pool, unsigned decay_ms);
+size_t magic_pool_trim(MagicPool* pool);
+size_t magic_trim();
+void magic_thread_cache_flush();
+
+// Arenas over a pool, NULL for the default pool
+MagicArena* magic_arena_create(MagicPool* pool, size_t chunk_size);
+void* magic_arena_alloc(MagicArena* arena, size_t size);
+MagicArenaMark magic_arena_mark(MagicArena* arena);
+void magic_arena_rewind(MagicArena* arena, MagicArenaMark mark);
+void magic_arena_reset(MagicArena* arena);
+void magic_arena_destroy(MagicArena* arena);
+
+// Sharded pools
+MagicShardedPool* magic_sharded_pool_create(size_t size, unsigned shards, MagicShardPolicy policy);
+void magic_sharded_pool_destroy(MagicShardedPool* sharded);
+void* magic_sharded_pool_malloc(MagicShardedPool* sharded, size_t size);
+void* magic_sharded_pool_realloc(MagicShardedPool* sharded, void* ptr, size_t new_size);
+void magic_sharded_pool_free(MagicShardedPool* sharded, void* ptr);
+MagicPool* magic_sharded_pool_local(MagicShardedPool* sharded);
+MagicPool* magic_sharded_pool_owner(MagicShardedPool* sharded, void* ptr);
+
+// Slab caches over a pool, NULL for the default pool
+MagicSlabCache* magic_slab_create(MagicPool* pool, size_t object_size);
+void* magic_slab_alloc(MagicSlabCache* cache);
+void magic_slab_free(MagicSlabCache* cache, void* ptr);
+void magic_slab_destroy(MagicSlabCache* cache);
+
+// Shared pools
+MagicSharedPool* magic_shared_pool_create(const char* name, size_t size);
+MagicSharedPool* magic_shared_pool_attach(const char* name);
+void magic_shared_pool_detach(MagicSharedPool* shared);
+int magic_shared_pool_unlink(const char* name);
+void* magic_shared_pool_malloc(MagicSharedPool* shared, size_t size);
+void magic_shared_pool_free(MagicSharedPool* shared, void* ptr);
+size_t magic_shared_pool_offset(MagicSharedPool* shared, void* ptr);
+void* magic_shared_pool_pointer(MagicSharedPool* shared, size_t offset);
+MagicError magic_shared_pool_check(MagicSharedPool* shared);
+
+MagicPool* magic_default_pool();
+void magic_set_default_pool(MagicPool* pool);
+
+void magic_set_error_handler(MagicErrorHandler handler);
+MagicError magic_last_error();
+const char* magic_error_string(MagicError error);
+MagicError magic_pool_check(MagicPool* pool);
+
+void magic_pool_stats(MagicPool* pool, MagicStats* stats);
+void magic_stats(MagicStats* stats);
+
+int magic_trace_start(const char* path, size_t capacity);
+void magic_trace_stop();
+
 #endif // MAIN_H
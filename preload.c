@@ -0,0 +1,171 @@
+// Drop-in replacement for the C allocation functions, built as libmagic.so
+// (make preload) and loaded into unmodified programs with
+//
+//     LD_PRELOAD=./libmagic.so ./program
+//
+// Every call is served by one growable pool, installed as the default pool.
+// Setting MAGIC_TRACE=file records the process's allocations for
+// make replay TRACE=file, to compare every backend on the same workload.
+// The library is built with MAGIC_ALIGNMENT=16 to keep malloc's alignment
+// guarantee and with checks compiled out. Linux only.
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "main.h"
+
+#define EXPORT __attribute__((visibility("default")))
+
+#define HEAP_INITIAL_SIZE ((size_t)1 << 20)
+#define HEAP_MAX_SIZE ((size_t)32 << 30)        // address space reserved up front
+#define HEAP_MIN_RESERVE ((size_t)256 << 20)    // smallest reservation tried before giving up
+#define HEAP_MMAP_THRESHOLD ((size_t)128 << 10) // larger requests get mappings of their own
+#define HEAP_PURGE_DECAY_MS 10000               // free pages unused this long go back to the OS
+#define TRACE_CAPACITY ((size_t)1 << 22)        // records kept when tracing through MAGIC_TRACE
+
+static MagicPool* heap;                         // NULL until the first allocation
+static pthread_once_t heap_once = PTHREAD_ONCE_INIT;
+static __thread int heap_creating;              // set while this thread creates the heap
+
+static void heap_create() {
+    heap_creating = 1;
+    MagicPool* pool = NULL;
+    for (size_t reserve = HEAP_MAX_SIZE; !pool && reserve >= HEAP_MIN_RESERVE; reserve /= 2) {
+        pool = magic_pool_create_growable(HEAP_INITIAL_SIZE, reserve);
+    }
+    if (pool) {
+        magic_pool_set_thread_cache(pool, 1);
+        magic_pool_set_mmap_threshold(pool, HEAP_MMAP_THRESHOLD);
+        magic_pool_set_purge_decay(pool, HEAP_PURGE_DECAY_MS);
+        magic_set_default_pool(pool);
+        __atomic_store_n(&heap, pool, __ATOMIC_RELEASE);
+    }
+    heap_creating = 0;
+}
+
+// The heap is created by the first allocation rather than a constructor, as
+// the loader, libc and other libraries' constructors allocate before ours
+// runs. Creating it allocates nothing itself (no dlsym, no stdio on success),
+// so no bootstrap buffer is needed; an allocation made while creating it,
+// only possible from the error message when the OS refuses every
+// reservation, fails instead of deadlocking.
+static int heap_ready() {
+    if (__atomic_load_n(&heap, __ATOMIC_ACQUIRE)) return 1;
+    if (heap_creating) return 0;
+    pthread_once(&heap_once, heap_create);
+    return heap != NULL;
+}
+
+// Pointers from anywhere else, such as the loader's own early allocator,
+// are left alone.
+static int heap_owns(void* ptr) {
+    MagicPool* pool = __atomic_load_n(&heap, __ATOMIC_ACQUIRE);
+    return pool && magic_pool_owns(pool, ptr);
+}
+
+// fork copies the heap in whatever state other threads leave it, so the heap
+// lock is held across it. The child starts with a consistent heap and a fresh
+// lock; blocks cached by threads that do not exist in the child stay allocated.
+static void heap_fork_prepare() {
+    if (heap) pthread_mutex_lock(&heap->lock);
+}
+
+static void heap_fork_parent() {
+    if (heap) pthread_mutex_unlock(&heap->lock);
+}
+
+// Children stop tracing, as their block offsets would mix with the parent's
+// in the shared trace file.
+static void heap_fork_child() {
+    if (heap) pthread_mutex_init(&heap->lock, NULL);
+    magic_trace_stop();
+}
+
+__attribute__((constructor)) static void preload_init() {
+    heap_ready();
+    pthread_atfork(heap_fork_prepare, heap_fork_parent, heap_fork_child);
+    const char* trace_path = getenv("MAGIC_TRACE");
+    if (trace_path && heap) {
+        magic_trace_start(trace_path, TRACE_CAPACITY);
+    }
+}
+
+__attribute__((destructor)) static void preload_exit() {
+    magic_trace_stop();
+}
+
+EXPORT void* malloc(size_t size) {
+    void* ptr = heap_ready() ? magic_malloc(size ? size : 1) : NULL;
+    if (!ptr) errno = ENOMEM;
+    return ptr;
+}
+
+EXPORT void free(void* ptr) {
+    if (ptr && heap_owns(ptr)) {
+        magic_free(ptr);
+    }
+}
+
+EXPORT void* calloc(size_t num, size_t size) {
+    size_t total;
+    if (__builtin_mul_overflow(num, size, &total) || !heap_ready()) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    void* ptr = magic_calloc(total ? total : 1, 1);
+    if (!ptr) errno = ENOMEM;
+    return ptr;
+}
+
+EXPORT void* realloc(void* ptr, size_t size) {
+    if (!ptr) return malloc(size);
+    if (!size) {
+        free(ptr);
+        return NULL;
+    }
+    void* new_ptr = heap_owns(ptr) ? magic_realloc(ptr, size) : NULL;
+    if (!new_ptr) errno = ENOMEM;
+    return new_ptr;
+}
+
+EXPORT int posix_memalign(void** memptr, size_t alignment, size_t size) {
+    if (!heap_ready()) return ENOMEM;
+    return magic_posix_memalign(memptr, alignment, size ? size : 1);
+}
+
+EXPORT void* memalign(size_t alignment, size_t size) {
+    if (alignment < MAGIC_ALIGNMENT) {
+        alignment = MAGIC_ALIGNMENT;
+    }
+    if (alignment & (alignment - 1)) {
+        errno = EINVAL;
+        return NULL;
+    }
+    void* ptr = heap_ready() ? magic_memalign(alignment, size ? size : 1) : NULL;
+    if (!ptr) errno = ENOMEM;
+    return ptr;
+}
+
+EXPORT void* aligned_alloc(size_t alignment, size_t size) {
+    return memalign(alignment, size);
+}
+
+EXPORT void* valloc(size_t size) {
+    return memalign((size_t)sysconf(_SC_PAGESIZE), size);
+}
+
+EXPORT void* pvalloc(size_t size) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    return memalign(page, (size + page - 1) & ~(page - 1));
+}
+
+EXPORT size_t malloc_usable_size(void* ptr) {
+    return ptr && heap_owns(ptr) ? magic_usable_size(ptr) : 0;
+}
+
+EXPORT int malloc_trim(size_t pad) {
+    (void)pad;
+    return heap_ready() && magic_trim() > 0;
+}
@@ -26,6 +26,8 @@ void test_realloc_zero_size();
 
 void test_worst_case_malloc();
 void test_worst_case_free();
+void test_worst_case_latency();
+void test_thread_scaling();
 // Helper Function Prototypes
 void clear_memory_pool();
 
@@ -35,10 +37,147 @@ void clear_memory_pool();
 void test_left_coalescing();
 void test_right_coalescing();
 void test_full_coalescing();
+void test_boundary_tags();
+
+// pool testing
+
+void test_pool_create_large();
+void test_pool_from_buffer();
+void test_pools_are_isolated();
+
+// size class testing
+
+void test_exact_bin_reuse();
+void test_bitmap_tracks_bins();
+void test_compact_header();
+
+// tlsf testing
+
+void test_tlsf_alloc_free();
+void test_tlsf_good_fit();
+
+// thread testing
+
+void test_thread_cache_reuse();
+void test_concurrent_alloc();
+
+// realloc testing
+
+void test_realloc_grow_into_neighbour();
+void test_realloc_move_when_blocked();
+void test_realloc_growing_buffer();
+
+// buddy testing
+
+void test_buddy_split_merge();
+void test_buddy_realloc();
+
+// trace testing
+
+void test_trace_records();
+void test_trace_ring_wraps();
+
+// stats testing
+
+void test_stats_track_heap();
+void test_stats_count_cached_calls();
+
+// check testing
+
+void test_error_handler();
+void test_heap_check();
+
+// alignment testing
+
+void test_memalign_returns_slack();
+void test_posix_memalign();
+
+// batch testing
+
+void test_batch_contiguous();
+void test_batch_partial();
+
+// growth testing
+
+void test_growable_pool();
+void test_growable_tail_merge();
+
+// large block testing
+
+void test_large_blocks_bypass_pool();
+void test_large_realloc();
+
+// purge testing
+
+void test_trim_purges_free_pages();
+void test_purged_merge_count();
+void test_purge_decay();
+
+// fit testing
+
+void test_best_fit();
+void test_next_fit_and_switching();
+
+// arena testing
+
+void test_arena_bump_and_reset();
+void test_arena_mark_rewind();
+
+// shard testing
+
+void test_sharded_pool_routing();
+void test_sharded_pool_spill();
+
+// slab testing
+
+void test_slab_alloc_free();
+void test_slab_threads();
+
+// fast bin testing
+
+void test_fast_bin_reuse();
+void test_fast_bin_consolidation();
+
+// persistent pool testing
+
+void test_persistent_pool_reopen();
+void test_persistent_pool_damage();
+
+// shared pool testing
+
+void test_shared_pool_handoff();
+void test_shared_pool_owner_death();
+
+// calloc testing
+
+void test_calloc_overflow_and_reuse();
+void test_calloc_fresh_memory();
 
 // Function to run all tests
 void run_all_tests();
 void run_performace_tests();
 void run_coalesing_tests();
+void run_pool_tests();
+void run_size_class_tests();
+void run_tlsf_tests();
+void run_thread_tests();
+void run_realloc_tests();
+void run_buddy_tests();
+void run_trace_tests();
+void run_stats_tests();
+void run_check_tests();
+void run_alignment_tests();
+void run_batch_tests();
+void run_growth_tests();
+void run_large_block_tests();
+void run_purge_tests();
+void run_fit_tests();
+void run_arena_tests();
+void run_shard_tests();
+void run_slab_tests();
+void run_fast_bin_tests();
+void run_persist_tests();
+void run_shared_pool_tests();
+void run_calloc_tests();
 
 #endif // TEST_H
@@ -1,13 +1,38 @@
 #include "test.h"
 #include "main.h"
 #include <time.h>
-#include <windows.h>
 #include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <errno.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 // Performance Testings
 
-static void log_performance(const char* operation, size_t size, LARGE_INTEGER start, LARGE_INTEGER end, LARGE_INTEGER frequency) {
-    double time_taken = (double)(end.QuadPart - start.QuadPart) * 1000.0 / frequency.QuadPart;
-    printf("%s of %llu bytes took %.5f ms\n", operation, size, time_taken);
+// Monotonic clock in seconds.
+static double now_seconds() {
+#ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / frequency.QuadPart;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+#endif
+}
+
+static void log_performance(const char* operation, size_t size, double start, double end) {
+    printf("%s of %zu bytes took %.5f ms\n", operation, size, (end - start) * 1000.0);
 }
 
 // Test Implementations
@@ -17,19 +42,17 @@ void test_allocate_full_pool() {
 
     initialize_memory_pool();
     
-    LARGE_INTEGER frequency, start_time, end_time;
-    QueryPerformanceFrequency(&frequency);
-    QueryPerformanceCounter(&start_time);
+    double start_time = now_seconds();
 
     void* ptr = magic_malloc(MEMORY_POOL_SIZE - BLOCK_SIZE);
 
-    QueryPerformanceCounter(&end_time);
-    log_performance("Allocate Full Pool", 0, start_time, end_time, frequency);
+    double end_time = now_seconds();
+    log_performance("Allocate Full Pool", 0, start_time, end_time);
 
     assert(ptr != NULL && "Failed to allocate full pool.");
 
     Block* block = (Block*)((char*)ptr - BLOCK_SIZE);
-    assert(block->size == MEMORY_POOL_SIZE - BLOCK_SIZE && block->free == 0);
+    assert(GET_SIZE(block) == MEMORY_POOL_SIZE - BLOCK_SIZE && !IS_FREE(block));
 
     TEST_SUCCESS("Allocate Full Pool");
     
@@ -50,9 +73,9 @@ void test_free_middle_block() {
     magic_free(ptr2);
 
     Block* block = (Block*)((char*)ptr2 - BLOCK_SIZE);
-    assert(block->free == 1 && "Middle block was not freed.");
-    assert(block->size == 256);
-    assert(block->next->free == 1 && "Did not point freed block node to next free block");
+    assert(IS_FREE(block) && "Middle block was not freed.");
+    assert(GET_SIZE(block) == 256);
+    assert(magic_malloc(256) == ptr2 && "Freed block was not filed in its size class");
 
     TEST_SUCCESS("Free Middle Block");
     visualize_memory_pool();
@@ -93,9 +116,11 @@ void test_allocate_and_free_all() {
 
     magic_free(ptr1);
 
-    assert(free_list->size == MEMORY_POOL_SIZE - BLOCK_SIZE && "Incorrect free block size after freeing all blocks.");
-    assert(free_list->next == NULL && "Free list should only contain one block.");
-    assert(free_list->free == 1 && "Free block should be marked as free.");
+    Block* first = (Block*)memory_pool;
+    assert(GET_SIZE(first) == MEMORY_POOL_SIZE - BLOCK_SIZE && "Incorrect free block size after freeing all blocks.");
+    FreeLinks* links = (FreeLinks*)(first + 1);
+    assert(links->next == 0 && links->prev == 0 && "Free list should only contain one block.");
+    assert(IS_FREE(first) && "Free block should be marked as free.");
 
     TEST_SUCCESS("Allocate and Free All");
     visualize_memory_pool();
@@ -114,15 +139,15 @@ void test_left_coalescing() {
 
     magic_free(ptr2);
 
-    assert(free_list == (ptr2 - BLOCK_SIZE) && "Free list not updated to start at pt2");
+    assert(IS_FREE(((Block*)((char*)ptr2 - BLOCK_SIZE))) && "ptr2 was not freed");
     magic_free(ptr3);
 
     Block* block = (Block*)((char*)ptr2 - BLOCK_SIZE);
-    assert(block->size == 256 + BLOCK_SIZE + 128 && "Left coalescing failed.");
-    assert(block->free == 1 && "Block should be marked as free.");
+    assert(GET_SIZE(block) == 256 + BLOCK_SIZE + 128 && "Left coalescing failed.");
+    assert(IS_FREE(block) && "Block should be marked as free.");
 
     Block* block4 = (Block*)((char*)ptr4 - BLOCK_SIZE);
-    assert(block->next == block4->next && "Failed to update next in new free block.");
+    assert((char*)block + BLOCK_SIZE + GET_SIZE(block) == (char*)block4 && "Coalesced block does not end at block4.");
 
     TEST_SUCCESS("Left Coalescing");
     visualize_memory_pool();
@@ -140,17 +165,17 @@ void test_right_coalescing() {
     void* ptr4 = magic_malloc(64);
 
     magic_free(ptr3);
-    assert(free_list == (ptr3 - BLOCK_SIZE) && "Free list not updated to start at pt3");
+    assert(IS_FREE(((Block*)((char*)ptr3 - BLOCK_SIZE))) && "ptr3 was not freed");
 
     magic_free(ptr2);
 
     Block* block = (Block*)((char*)ptr2 - BLOCK_SIZE);
-    assert(block->size == 256 + BLOCK_SIZE + 128 && "Right coalescing failed.");
-    assert(block->free == 1 && "Block should be marked as free.");
-    assert(free_list == (ptr2 - BLOCK_SIZE) && "Free list not updated to start at pt2");
+    assert(GET_SIZE(block) == 256 + BLOCK_SIZE + 128 && "Right coalescing failed.");
+    assert(IS_FREE(block) && "Block should be marked as free.");
+    assert(magic_malloc(256 + BLOCK_SIZE + 128) == ptr2 && "Coalesced block not reusable at its new size");
 
     Block* block4 = (Block*)((char*)ptr4 - BLOCK_SIZE);
-    assert(block->next == block4->next && "ptr2 next not updated to next free block");
+    assert(!IS_FREE(block4) && "Right coalescing must stop at an allocated block");
 
     TEST_SUCCESS("Right Coalescing");
     visualize_memory_pool();
@@ -170,22 +195,56 @@ void test_full_coalescing() {
     magic_free(ptr2);
     magic_free(ptr4);
 
+    size_t tail = MEMORY_POOL_SIZE - 5 * BLOCK_SIZE - (128 + 256 + 128 + 64);   // untouched space after ptr4
     Block* block4 = (Block*)((char*)ptr4 - BLOCK_SIZE);
-    assert(block4->size == 64 + BLOCK_SIZE + 328 && "right coalescing failed");
+    assert(GET_SIZE(block4) == 64 + BLOCK_SIZE + tail && "right coalescing failed");
     magic_free(ptr3);
 
 
     Block* block = (Block*)((char*)ptr2 - BLOCK_SIZE);
-    assert(free_list == block && "Free list not updated to start at block2");
-    assert(block->size == 256 + BLOCK_SIZE + 128 + BLOCK_SIZE + 64 + BLOCK_SIZE + 328 && "Full coalescing failed.");
-    assert(block->free == 1 && "Block should be marked as free.");
-    assert(block->next == NULL && "Block not updated to point to null");
+    assert(GET_SIZE(block) == 256 + BLOCK_SIZE + 128 + BLOCK_SIZE + 64 + BLOCK_SIZE + tail && "Full coalescing failed.");
+    assert(IS_FREE(block) && "Block should be marked as free.");
+    assert((char*)block + BLOCK_SIZE + GET_SIZE(block) == memory_pool + MEMORY_POOL_SIZE && "Block not extended to the end of the pool");
+    FreeLinks* links = (FreeLinks*)(block + 1);
+    assert(links->next == 0 && links->prev == 0 && "Coalesced block should be alone in its bin");
 
     TEST_SUCCESS("Full Coalescing");
     visualize_memory_pool();
     clear_memory_pool();
 }
 
+void test_boundary_tags() {
+    TEST_START("Boundary Tags");
+
+    initialize_memory_pool();
+
+    void* ptr1 = magic_malloc(64);
+    void* ptr2 = magic_malloc(96);
+    void* ptr3 = magic_malloc(32);
+    Block* block1 = (Block*)((char*)ptr1 - BLOCK_SIZE);
+    Block* block2 = (Block*)((char*)ptr2 - BLOCK_SIZE);
+    Block* block3 = (Block*)((char*)ptr3 - BLOCK_SIZE);
+
+    assert(!PREV_IS_FREE(block1) && !PREV_IS_FREE(block2) && !PREV_IS_FREE(block3));
+
+    magic_free(ptr1);
+    assert(PREV_IS_FREE(block2) && "Right neighbour not told its left neighbour is free");
+    assert(*((size_t*)block2 - 1) == 64 && "Boundary tag does not hold the free block size");
+
+    // Freeing block2 must find block1 through the tag and merge into it
+    magic_free(ptr2);
+    assert(GET_SIZE(block1) == 64 + BLOCK_SIZE + 96 && "Left coalescing through the boundary tag failed");
+    assert(PREV_IS_FREE(block3) && *((size_t*)block3 - 1) == GET_SIZE(block1));
+
+    // Reallocating the merged block clears the flag again
+    assert(magic_malloc(64 + BLOCK_SIZE + 96) == ptr1);
+    assert(!PREV_IS_FREE(block3) && "Allocated left neighbour still flagged as free");
+
+    TEST_SUCCESS("Boundary Tags");
+    visualize_memory_pool();
+    clear_memory_pool();
+}
+
 void test_double_free() {
     TEST_START("Double Free");
 
@@ -194,12 +253,12 @@ void test_double_free() {
     magic_free(ptr);
 
     Block* block = (Block*)((char*)ptr - BLOCK_SIZE);
-    assert(block->free == 1 && "Block should be marked as free.");
+    assert(IS_FREE(block) && "Block should be marked as free.");
 
     printf("Attempting double free...\n");
     magic_free(ptr); // Should not crash or corrupt memory
 
-    assert(block->free == 1 && "Double free should not corrupt block state.");
+    assert(IS_FREE(block) && "Double free should not corrupt block state.");
 
     TEST_SUCCESS("Double Free");
 
@@ -222,7 +281,7 @@ void test_calloc() {
     assert(ptr != NULL);
 
     Block* block = (Block*)((char*)ptr - BLOCK_SIZE);
-    assert(block->size == 128 && block->free == 0);
+    assert(GET_SIZE(block) == 128 && !IS_FREE(block));
 
     TEST_SUCCESS("Calloc");
 
@@ -238,7 +297,7 @@ void test_realloc_null_pointer() {
     assert(ptr != NULL && "Failed to allocate memory with realloc for NULL pointer.");
     
     Block* block = (Block*)((char*)ptr - BLOCK_SIZE);
-    assert(block->size == 128 && block->free == 0);
+    assert(GET_SIZE(block) == 128 && !IS_FREE(block));
 
     TEST_SUCCESS("Realloc Null Pointer");
     visualize_memory_pool();
@@ -259,7 +318,11 @@ void test_realloc_smaller_size() {
     assert(*(int*)new_ptr == 3 && "Realloc did not properly copy data.");
 
     Block* block = (Block*)((char*)new_ptr - BLOCK_SIZE);
-    assert(block->size == 256 && block->free == 0);
+    assert(GET_SIZE(block) == 128 && !IS_FREE(block) && "Shrinking realloc should split off the tail");
+
+    Block* tail = (Block*)((char*)new_ptr + 128);
+    assert(IS_FREE(tail) && "Tail was not returned to the heap");
+    assert((char*)tail + BLOCK_SIZE + GET_SIZE(tail) == memory_pool + MEMORY_POOL_SIZE && "Tail did not merge with the free space after it");
 
     TEST_SUCCESS("Realloc Smaller Size");
     visualize_memory_pool();
@@ -275,9 +338,10 @@ void test_realloc_larger_size() {
 
     void* new_ptr = magic_realloc(ptr, 256);
     assert(new_ptr != NULL && "Failed to realloc to larger size.");
+    assert(new_ptr == ptr && "Free right neighbour should be absorbed in place");
     
     Block* block = (Block*)((char*)new_ptr - BLOCK_SIZE);
-    assert(block->size == 256 && block->free == 0);
+    assert(GET_SIZE(block) == 256 && !IS_FREE(block));
 
     TEST_SUCCESS("Realloc Larger Size");
     visualize_memory_pool();
@@ -296,7 +360,7 @@ void test_realloc_free_block() {
     assert(new_ptr != NULL && "Failed to realloc a free block.");
 
     Block* block = (Block*)((char*)new_ptr - BLOCK_SIZE);
-    assert(block->size == 256 && block->free == 0);
+    assert(GET_SIZE(block) == 256 && !IS_FREE(block));
 
     TEST_SUCCESS("Realloc Free Block");
     visualize_memory_pool();
@@ -317,6 +381,40 @@ void test_realloc_zero_size() {
     visualize_memory_pool();
     clear_memory_pool();
 }
+typedef struct ThreadWork {
+    MagicPool* pool;
+    int seed;
+    int ops;
+} ThreadWork;
+
+// Random malloc/free churn that checks every block still holds its fill byte.
+static void* churn_thread(void* arg) {
+    ThreadWork* work = (ThreadWork*)arg;
+    enum { SLOTS = 64 };
+    unsigned char* slots[SLOTS] = {0};
+    size_t sizes[SLOTS] = {0};
+    unsigned int seed = (unsigned int)work->seed;
+
+    for (int op = 0; op < work->ops; op++) {
+        seed = seed * 1103515245u + 12345u;
+        int slot = (seed >> 16) % SLOTS;
+        if (slots[slot]) {
+            assert(slots[slot][0] == (unsigned char)slot && slots[slot][sizes[slot] - 1] == (unsigned char)slot);
+            magic_pool_free(work->pool, slots[slot]);
+            slots[slot] = NULL;
+        }
+        else {
+            sizes[slot] = (seed >> 8) % 16 == 0 ? 512 + (seed >> 4) % 4096 : 8 + (seed >> 4) % 248;
+            slots[slot] = magic_pool_malloc(work->pool, sizes[slot]);
+            if (slots[slot]) memset(slots[slot], slot, sizes[slot]);
+        }
+    }
+    for (int slot = 0; slot < SLOTS; slot++) {
+        if (slots[slot]) magic_pool_free(work->pool, slots[slot]);
+    }
+    return NULL;
+}
+
 /// ------------------------------- PERFORMANCE TESTS ------------------------------- //
 
 void test_worst_case_malloc() {
@@ -324,9 +422,7 @@ void test_worst_case_malloc() {
 
     initialize_memory_pool();
     
-    LARGE_INTEGER frequency, start_time, end_time;
-    QueryPerformanceFrequency(&frequency);
-    QueryPerformanceCounter(&start_time);
+    double start_time = now_seconds();
 
     // Allocate the entire memory pool in 1 Byte increments
     size_t alloc_size = 1;
@@ -337,8 +433,8 @@ void test_worst_case_malloc() {
         if (!ptr) break;
     }
 
-    QueryPerformanceCounter(&end_time);
-    log_performance("Worst Case Malloc", total_allocated, start_time, end_time, frequency);
+    double end_time = now_seconds();
+    log_performance("Worst Case Malloc", total_allocated, start_time, end_time);
 
     TEST_SUCCESS("Worst Case Malloc");
     //visualize_memory_pool();
@@ -360,26 +456,139 @@ void test_worst_case_free() {
         if (!ptr) break;
     }
 
-    LARGE_INTEGER frequency, start_time, end_time;
-    QueryPerformanceFrequency(&frequency);
-    QueryPerformanceCounter(&start_time);
+    double start_time = now_seconds();
 
     // Free the entire memory pool in 1 Byte increments
     Block* block_to_free = (Block*)memory_pool;
     while ((char*)block_to_free < memory_pool + MEMORY_POOL_SIZE) {
-        Block* next_block = (Block*)((char*)block_to_free + BLOCK_SIZE + block_to_free->size);
+        Block* next_block = (Block*)((char*)block_to_free + BLOCK_SIZE + GET_SIZE(block_to_free));
         magic_free((void*)(block_to_free + 1));
         block_to_free = next_block;
     }
 
-    QueryPerformanceCounter(&end_time);
-    log_performance("Worst Case Free", 0, start_time, end_time, frequency);
+    double end_time = now_seconds();
+    log_performance("Worst Case Free", 0, start_time, end_time);
 
     TEST_SUCCESS("Worst Case Free");
     visualize_memory_pool();
     clear_memory_pool();
 }
 
+static uint64_t read_cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+#endif
+}
+
+static int compare_cycles(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static void log_latency(const char* mode, const char* operation, uint64_t* samples, size_t count) {
+    uint64_t total = 0;
+    for (size_t i = 0; i < count; i++) total += samples[i];
+    qsort(samples, count, sizeof(uint64_t), compare_cycles);
+    printf("%-10s %-6s avg %6.1f  p99 %6llu  p99.9 %7llu  max %8llu cycles\n", mode, operation,
+           (double)total / count,
+           (unsigned long long)samples[count * 99 / 100],
+           (unsigned long long)samples[count * 999 / 1000],
+           (unsigned long long)samples[count - 1]);
+}
+
+// Random malloc/free churn over a fragmented heap, timing every single call.
+static void measure_latency(const char* name, MagicPoolMode mode) {
+    enum { SLOTS = 4096, OPS = 200000 };
+    static void* slots[SLOTS];
+    static uint64_t malloc_cycles[OPS], free_cycles[OPS];
+    size_t mallocs = 0, frees = 0;
+
+    MagicPool* pool = magic_pool_create_mode(64 * 1024 * 1024, mode);
+    memset(slots, 0, sizeof(slots));
+    srand(42);
+
+    for (int op = 0; op < OPS; op++) {
+        int slot = rand() % SLOTS;
+        if (slots[slot]) {
+            uint64_t start = read_cycles();
+            magic_pool_free(pool, slots[slot]);
+            free_cycles[frees++] = read_cycles() - start;
+            slots[slot] = NULL;
+        }
+        else {
+            size_t size = (size_t)8 << (rand() % 10);
+            size += (size_t)rand() % size;
+            uint64_t start = read_cycles();
+            slots[slot] = magic_pool_malloc(pool, size);
+            malloc_cycles[mallocs++] = read_cycles() - start;
+        }
+    }
+
+    log_latency(name, "malloc", malloc_cycles, mallocs);
+    log_latency(name, "free", free_cycles, frees);
+    magic_pool_destroy(pool);
+}
+
+void test_worst_case_latency() {
+    TEST_START("Worst Case Latency");
+
+    measure_latency("segregated", MAGIC_MODE_SEGREGATED);
+    measure_latency("tlsf", MAGIC_MODE_TLSF);
+
+    TEST_SUCCESS("Worst Case Latency");
+}
+
+static int online_cores() {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else
+    return (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+}
+
+// Runs the same per-thread churn on 1..N threads against one shared pool.
+static void measure_scaling(const char* name, int thread_cache, int max_threads) {
+    enum { OPS = 200000 };
+    pthread_t threads[64];
+    ThreadWork work[64];
+
+    for (int count = 1; count <= max_threads; count *= 2) {
+        MagicPool* pool = magic_pool_create(256 * 1024 * 1024);
+        magic_pool_set_thread_cache(pool, thread_cache);
+
+        double start_time = now_seconds();
+        for (int i = 0; i < count; i++) {
+            work[i] = (ThreadWork){ pool, i + 1, OPS };
+            pthread_create(&threads[i], NULL, churn_thread, &work[i]);
+        }
+        for (int i = 0; i < count; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        double end_time = now_seconds();
+
+        double seconds = end_time - start_time;
+        printf("%-8s %2d threads: %8.2f Mops/s\n", name, count, count * (double)OPS / seconds / 1e6);
+        magic_pool_destroy(pool);
+    }
+}
+
+void test_thread_scaling() {
+    TEST_START("Thread Scaling");
+
+    int cores = online_cores();
+    if (cores > 64) cores = 64;
+    measure_scaling("locked", 0, cores);
+    measure_scaling("tcache", 1, cores);
+
+    TEST_SUCCESS("Thread Scaling");
+}
+
 void test_realloc(){
     TEST_START("Realloc");
 
@@ -391,13 +600,1902 @@ void test_realloc(){
     assert(new_ptr != NULL && "Failed to realloc to larger size.");
     
     Block* block = (Block*)((char*)new_ptr - BLOCK_SIZE);
-    assert(block->size == 256 && block->free == 0);
+    assert(GET_SIZE(block) == 256 && !IS_FREE(block));
 
     TEST_SUCCESS("Realloc");
     visualize_memory_pool();
     clear_memory_pool();
 }
 
+/// ------------------------------- POOL TESTS ------------------------------- //
+
+void test_pool_create_large() {
+    TEST_START("Pool Create Large");
+
+    size_t pool_size = 64 * 1024 * 1024;
+    MagicPool* pool = magic_pool_create(pool_size);
+    assert(pool != NULL && "Failed to create an OS-backed pool.");
+
+    void* big = magic_pool_malloc(pool, 32 * 1024 * 1024);
+    assert(big != NULL && "Pool should serve allocations far beyond MEMORY_POOL_SIZE.");
+    memset(big, 0xAB, 32 * 1024 * 1024);
+
+    void* small = magic_pool_calloc(pool, 16, 16);
+    assert(small != NULL && ((char*)small)[255] == 0);
+
+    magic_pool_free(pool, big);
+    magic_pool_free(pool, small);
+    assert(GET_SIZE((Block*)pool->base) == pool->size - BLOCK_SIZE && "Freed pool should collapse back into one block.");
+
+    magic_pool_destroy(pool);
+    TEST_SUCCESS("Pool Create Large");
+}
+
+void test_pool_from_buffer() {
+    TEST_START("Pool From Buffer");
+
+    static char buffer[4096];
+    MagicPool* pool = magic_pool_from_buffer(buffer, sizeof(buffer));
+    assert(pool != NULL && "Failed to create a pool over a caller buffer.");
+    assert((char*)pool >= buffer && pool->base + pool->size <= buffer + sizeof(buffer));
+
+    void* ptr = magic_pool_malloc(pool, 2048);
+    assert(ptr != NULL && (char*)ptr > buffer && (char*)ptr < buffer + sizeof(buffer));
+
+    ptr = magic_pool_realloc(pool, ptr, 3000);
+    assert(ptr != NULL && "Realloc inside a buffer pool failed.");
+    magic_pool_free(pool, ptr);
+
+    assert(magic_pool_from_buffer(buffer, sizeof(MagicPool)) == NULL && "Tiny buffer should be rejected.");
+
+    TEST_SUCCESS("Pool From Buffer");
+}
+
+void test_pools_are_isolated() {
+    TEST_START("Pools Are Isolated");
+
+    initialize_memory_pool();
+    MagicPool* a = magic_pool_create(8192);
+    MagicPool* b = magic_pool_create(8192);
+    assert(a && b);
+
+    void* pa = magic_pool_malloc(a, 4096);
+    void* pb = magic_pool_malloc(b, 4096);
+    assert(pa && pb);
+    assert((char*)pa >= a->base && (char*)pa < a->base + a->size);
+    assert((char*)pb >= b->base && (char*)pb < b->base + b->size);
+
+    // Exhausting one pool must not affect the other or the default pool
+    assert(magic_pool_malloc(a, 8000) == NULL);
+    assert(magic_pool_malloc(b, 2048) != NULL);
+    assert(magic_malloc(512) != NULL);
+
+    // The magic_* wrappers follow the default pool
+    magic_set_default_pool(a);
+    void* pd = magic_malloc(1024);
+    assert((char*)pd >= a->base && (char*)pd < a->base + a->size);
+    magic_free(pd);
+    magic_set_default_pool(NULL);
+    assert(magic_default_pool()->base == memory_pool);
+
+    magic_pool_destroy(a);
+    magic_pool_destroy(b);
+    TEST_SUCCESS("Pools Are Isolated");
+    clear_memory_pool();
+}
+
+/// ------------------------------- SIZE CLASS TESTS ------------------------------- //
+
+void test_exact_bin_reuse() {
+    TEST_START("Exact Bin Reuse");
+
+    MagicPool* pool = magic_pool_create(1024 * 1024);
+    void* ptrs[64];
+    for (int i = 0; i < 64; i++) {
+        ptrs[i] = magic_pool_malloc(pool, 8 * (i % 8 + 1));
+        assert(ptrs[i] != NULL);
+    }
+    // Free every other block so no neighbours coalesce
+    for (int i = 0; i < 64; i += 2) {
+        magic_pool_free(pool, ptrs[i]);
+    }
+    // Each small request must come straight back from its exact bin
+    for (int i = 62; i >= 0; i -= 2) {
+        void* ptr = magic_pool_malloc(pool, 8 * (i % 8 + 1));
+        assert(ptr == ptrs[i] && "Small request not served from its exact bin");
+    }
+
+    magic_pool_destroy(pool);
+    TEST_SUCCESS("Exact Bin Reuse");
+}
+
+void test_bitmap_tracks_bins() {
+    TEST_START("Bitmap Tracks Bins");
+
+    MagicPool* pool = magic_pool_create(1024 * 1024);
+    void* a = magic_pool_malloc(pool, 1000);
+    void* guard1 = magic_pool_malloc(pool, 8);
+    void* b = magic_pool_malloc(pool, 64);
+    void* guard2 = magic_pool_malloc(pool, 8);
+    void* rest = magic_pool_malloc(pool, 900 * 1024);
+    assert(a && guard1 && b && guard2 && rest);
+
+    uint64_t before = pool->bin_bitmap;
+    magic_pool_free(pool, b);
+    assert(pool->bin_bitmap != before && "Freeing into an empty bin must set its bit");
+    assert(magic_pool_malloc(pool, 64) == b);
+    assert(pool->bin_bitmap == before && "Emptying a bin must clear its bit");
+
+    // A 100 byte request finds the 1000 byte block in a higher bin
+    magic_pool_free(pool, a);
+    void* c = magic_pool_malloc(pool, 100);
+    assert(c == a && "Bit scan did not locate the larger bin");
+
+    magic_pool_destroy(pool);
+    TEST_SUCCESS("Bitmap Tracks Bins");
+}
+
+/// ------------------------------- TLSF TESTS ------------------------------- //
+
+void test_tlsf_alloc_free() {
+    TEST_START("TLSF Alloc Free");
+
+    MagicPool* pool = magic_pool_create_mode(4 * 1024 * 1024, MAGIC_MODE_TLSF);
+    assert(pool != NULL && pool->mode == MAGIC_MODE_TLSF && pool->tlsf != NULL);
+
+    void* ptrs[256];
+    for (int i = 0; i < 256; i++) {
+        ptrs[i] = magic_pool_malloc(pool, 8 + (size_t)i * 97);
+        assert(ptrs[i] != NULL);
+        memset(ptrs[i], i, 8 + (size_t)i * 97);
+    }
+    for (int i = 0; i < 256; i++) {
+        assert(((unsigned char*)ptrs[i])[0] == (unsigned char)i && "TLSF blocks overlap");
+    }
+    for (int i = 0; i < 256; i += 2) {
+        magic_pool_free(pool, ptrs[i]);
+    }
+    for (int i = 1; i < 256; i += 2) {
+        magic_pool_free(pool, ptrs[i]);
+    }
+
+    Block* first = (Block*)pool->base;
+    assert(IS_FREE(first) && GET_SIZE(first) == pool->size - BLOCK_SIZE && "TLSF pool did not coalesce back to one block");
+
+    TlsfIndex* tlsf = pool->tlsf;
+    int set_levels = 0;
+    for (int fl = 0; fl < TLSF_FL_COUNT; fl++) {
+        if (tlsf->sl_bitmap[fl]) set_levels++;
+    }
+    assert(set_levels == 1 && __builtin_popcountll(tlsf->fl_bitmap) == 1 && "Stale TLSF bitmap bits");
+
+    magic_pool_destroy(pool);
+    TEST_SUCCESS("TLSF Alloc Free");
+}
+
+void test_tlsf_good_fit() {
+    TEST_START("TLSF Good Fit");
+
+    MagicPool* pool = magic_pool_create_mode(1024 * 1024, MAGIC_MODE_TLSF);
+    void* small = magic_pool_malloc(pool, 48);
+    void* guard1 = magic_pool_malloc(pool, 8);
+    void* medium = magic_pool_malloc(pool, 3000);
+    void* guard2 = magic_pool_malloc(pool, 8);
+    void* rest = magic_pool_malloc(pool, 900 * 1024);
+    assert(small && guard1 && medium && guard2 && rest);
+
+    magic_pool_free(pool, small);
+    magic_pool_free(pool, medium);
+
+    // Small classes are exact, so 48 bytes comes back from its own class
+    assert(magic_pool_malloc(pool, 48) == small);
+    // 2000 rounds up to a class the 3000 byte block satisfies
+    assert(magic_pool_malloc(pool, 2000) == medium);
+    // Nothing large is left
+    assert(magic_pool_malloc(pool, 200 * 1024) == NULL);
+
+    magic_pool_destroy(pool);
+    TEST_SUCCESS("TLSF Good Fit");
+}
+
+/// ------------------------------- THREAD TESTS ------------------------------- //
+
+void test_thread_cache_reuse() {
+    TEST_START("Thread Cache Reuse");
+
+    MagicPool* pool = magic_pool_create(1024 * 1024);
+    magic_pool_set_thread_cache(pool, 1);
+
+    void* ptr = magic_pool_malloc(pool, 64);
+    Block* block = (Block*)((char*)ptr - BLOCK_SIZE);
+    magic_pool_free(pool, ptr);
+    assert(!IS_FREE(block) && "Small free should stay in the thread cache, allocated to the pool");
+
+    assert(magic_pool_malloc(pool, 64) == ptr && "Cached block not handed straight back");
+    magic_pool_free(pool, ptr);
+
+    magic_thread_cache_flush();
+    Block* first = (Block*)pool->base;
+    assert(IS_FREE(first) && GET_SIZE(first) == pool->size - BLOCK_SIZE && "Flush did not return every cached block");
+
+    magic_pool_destroy(pool);
+    TEST_SUCCESS("Thread Cache Reuse");
+}
+
+void test_concurrent_alloc() {
+    TEST_START("Concurrent Alloc");
+
+    enum { THREADS = 8 };
+    MagicPool* pool = magic_pool_create(16 * 1024 * 1024);
+    magic_pool_set_thread_cache(pool, 1);
+
+    pthread_t threads[THREADS];
+    ThreadWork work[THREADS];
+    for (int i = 0; i < THREADS; i++) {
+        work[i] = (ThreadWork){ pool, i + 1, 100000 };
+        pthread_create(&threads[i], NULL, churn_thread, &work[i]);
+    }
+    for (int i = 0; i < THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    // Exiting threads flush their caches, so the heap must be whole again
+    Block* first = (Block*)pool->base;
+    assert(IS_FREE(first) && GET_SIZE(first) == pool->size - BLOCK_SIZE && "Blocks leaked or heap corrupted across threads");
+
+    magic_pool_destroy(pool);
+    TEST_SUCCESS("Concurrent Alloc");
+}
+
+/// ------------------------------- REALLOC TESTS ------------------------------- //
+
+void test_realloc_grow_into_neighbour() {
+    TEST_START("Realloc Grow Into Neighbour");
+
+    initialize_memory_pool();
+    char* ptr1 = magic_malloc(64);
+    void* ptr2 = magic_malloc(128);
+    void* ptr3 = magic_malloc(64);
+    memset(ptr1, 'x', 64);
+
+    magic_free(ptr2);
+    char* grown = magic_realloc(ptr1, 64 + BLOCK_SIZE + 64);
+    assert(grown == ptr1 && "Realloc should grow into the free right neighbour");
+    assert(grown[0] == 'x' && grown[63] == 'x');
+
+    // What is left of ptr2 stays free and still ends at ptr3
+    Block* rest = (Block*)(grown + 64 + BLOCK_SIZE + 64);
+    assert(IS_FREE(rest) && (char*)rest + BLOCK_SIZE + GET_SIZE(rest) == (char*)ptr3 - BLOCK_SIZE);
+    assert(PREV_IS_FREE(((Block*)((char*)ptr3 - BLOCK_SIZE))));
+
+    TEST_SUCCESS("Realloc Grow Into Neighbour");
+    visualize_memory_pool();
+    clear_memory_pool();
+}
+
+void test_realloc_move_when_blocked() {
+    TEST_START("Realloc Move When Blocked");
+
+    initialize_memory_pool();
+    char* ptr1 = magic_malloc(64);
+    void* ptr2 = magic_malloc(64);
+    for (int i = 0; i < 64; i++) ptr1[i] = (char)i;
+
+    char* moved = magic_realloc(ptr1, 200);
+    assert(moved != NULL && moved != ptr1 && "Allocated neighbour forces a move");
+    for (int i = 0; i < 64; i++) assert(moved[i] == (char)i && "Moved data corrupted");
+    assert(IS_FREE(((Block*)(ptr1 - BLOCK_SIZE))) && "Old block not freed after the move");
+
+    // A request that cannot be met leaves the original allocation alone
+    assert(magic_realloc(moved, MEMORY_POOL_SIZE) == NULL);
+    assert(!IS_FREE(((Block*)(moved - BLOCK_SIZE))) && moved[10] == 10);
+
+    magic_free(ptr2);
+    TEST_SUCCESS("Realloc Move When Blocked");
+    visualize_memory_pool();
+    clear_memory_pool();
+}
+
+void test_realloc_growing_buffer() {
+    TEST_START("Realloc Growing Buffer");
+
+    MagicPool* pool = magic_pool_create(1024 * 1024);
+    size_t capacity = 16;
+    char* buffer = magic_pool_malloc(pool, capacity);
+    char* first = buffer;
+    for (size_t length = 0; length < 100000; length++) {
+        if (length == capacity) {
+            capacity *= 2;
+            buffer = magic_pool_realloc(pool, buffer, capacity);
+            assert(buffer == first && "Growing the only allocation should never move it");
+        }
+        buffer[length] = (char)length;
+    }
+    for (size_t i = 0; i < 100000; i++) assert(buffer[i] == (char)i);
+
+    buffer = magic_pool_realloc(pool, buffer, 64);
+    Block* first_block = (Block*)pool->base;
+    Block* tail = (Block*)((char*)first_block + BLOCK_SIZE + GET_SIZE(first_block));
+    assert(IS_FREE(tail) && GET_SIZE(tail) == pool->size - 2 * BLOCK_SIZE - 64 && "Shrink did not release the tail");
+
+    magic_pool_destroy(pool);
+    TEST_SUCCESS("Realloc Growing Buffer");
+}
+
+void test_compact_header() {
+    TEST_START("Compact Header");
+
+    initialize_memory_pool();
+    assert(BLOCK_SIZE == 8 && "Block header should be a single word");
+
+    char* a = magic_malloc(8);
+    char* b = magic_malloc(8);
+    char* c = magic_malloc(24);
+    char* d = magic_malloc(24);
+    assert(b - a == BLOCK_SIZE + MIN_PAYLOAD && "Tiny allocations should cost one header plus the minimum payload");
+    assert(d - c == BLOCK_SIZE + 24 && "Per-allocation overhead should be one word");
+
+    // Free blocks keep their links in the payload; allocated ones do not need them
+    memset(c, 0xFF, 24);
+    magic_free(c);
+    Block* block = (Block*)(c - BLOCK_SIZE);
+    assert(IS_FREE(block) && GET_SIZE(block) == 24);
+    assert(magic_malloc(24) == c);
+
+    TEST_SUCCESS("Compact Header");
+    visualize_memory_pool();
+    clear_memory_pool();
+}
+
+/// ------------------------------- BUDDY TESTS ------------------------------- //
+
+void test_buddy_split_merge() {
+    TEST_START("Buddy Split Merge");
+
+    // The region past the descriptor carves into a 1 MiB block, a 4 KiB block and smaller ones
+    MagicPool* pool = magic_pool_create_mode(1024 * 1024 + 4096 + 2048, MAGIC_MODE_BUDDY);
+    assert(pool != NULL && pool->mode == MAGIC_MODE_BUDDY);
+    uint64_t carved = pool->bin_bitmap;
+    assert((carved >> 20 & 1) && (carved >> 12 & 1) && "Region not carved into power of two blocks");
+    assert(magic_pool_check(pool) == MAGIC_OK);
+
+    void* ptrs[200];
+    for (int i = 0; i < 200; i++) {
+        size_t size = (size_t)16 << (i % 8);
+        ptrs[i] = magic_pool_malloc(pool, size);
+        assert(ptrs[i] != NULL);
+
+        Block* block = (Block*)((char*)ptrs[i] - BLOCK_SIZE);
+        size_t span = GET_SIZE(block) + BLOCK_SIZE;
+        assert((span & (span - 1)) == 0 && span >= size + BLOCK_SIZE && "Buddy block is not a power of two");
+        assert((((char*)block - pool->base) & (span - 1)) == 0 && "Buddy block not aligned to its size");
+        memset(ptrs[i], i, size);
+    }
+    for (int i = 0; i < 200; i++) {
+        assert(((unsigned char*)ptrs[i])[0] == (unsigned char)i && "Buddy blocks overlap");
+    }
+    assert(magic_pool_check(pool) == MAGIC_OK);
+    for (int i = 199; i >= 0; i -= 2) {
+        magic_pool_free(pool, ptrs[i]);
+    }
+    for (int i = 0; i < 200; i += 2) {
+        magic_pool_free(pool, ptrs[i]);
+    }
+
+    Block* first = (Block*)pool->base;
+    assert(IS_FREE(first) && GET_SIZE(first) == 1024 * 1024 - BLOCK_SIZE && "Buddies did not merge back");
+    assert(pool->bin_bitmap == carved && "Stale buddy bitmap bits");
+    assert(magic_pool_check(pool) == MAGIC_OK);
+
+    magic_pool_destroy(pool);
+    TEST_SUCCESS("Buddy Split Merge");
+}
+
+void test_buddy_realloc() {
+    TEST_START("Buddy Realloc");
+
+    MagicPool* pool = magic_pool_create_mode(64 * 1024, MAGIC_MODE_BUDDY);
+    uint64_t carved = pool->bin_bitmap;
+    char* data = magic_pool_malloc(pool, 4000);         // a 4 KiB block
+    assert(data != NULL);
+    memset(data, 'b', 4000);
+
+    // Shrinking halves the block in place
+    assert(magic_pool_realloc(pool, data, 1000) == data);
+    Block* block = (Block*)(data - BLOCK_SIZE);
+    assert(GET_SIZE(block) == 1024 - BLOCK_SIZE && "Buddy shrink kept the upper halves");
+
+    // The freed upper halves are reused
+    void* reuse = magic_pool_malloc(pool, 2000);
+    assert(reuse == data + 2048 && "Upper half not reused");
+    assert(magic_pool_check(pool) == MAGIC_OK);
+
+    // Growing moves the data to a larger block
+    char* grown = magic_pool_realloc(pool, data, 8000);
+    assert(grown != NULL && grown[0] == 'b' && grown[999] == 'b');
+
+    magic_pool_free(pool, grown);
+    magic_pool_free(pool, reuse);
+    assert(pool->bin_bitmap == carved && "Buddy pool did not merge back");
+    assert(magic_pool_check(pool) == MAGIC_OK);
+
+    magic_pool_destroy(pool);
+    TEST_SUCCESS("Buddy Realloc");
+}
+
+/// ------------------------------- TRACE TESTS ------------------------------- //
+
+// Reads back a trace file: header first, then the record slots.
+static int read_trace(const char* path, MagicTraceHeader* header, MagicTraceRecord* records, size_t count) {
+    FILE* file = fopen(path, "rb");
+    if (!file) return 0;
+    int ok = fread(header, sizeof(*header), 1, file) == 1 &&
+             fread(records, sizeof(*records), count, file) == count;
+    fclose(file);
+    return ok;
+}
+
+void test_trace_records() {
+    TEST_START("Trace Records");
+
+    const char* path = "magic_test_trace.bin";
+    initialize_memory_pool();
+    assert(magic_trace_start(path, 16) == 0 && "Could not start tracing");
+
+    void* a = magic_malloc(100);
+    void* b = magic_calloc(4, 8);
+    void* c = magic_realloc(a, 200);
+    magic_free(b);
+    magic_free(c);
+    magic_trace_stop();
+
+    MagicTraceHeader header;
+    MagicTraceRecord records[16];
+    assert(read_trace(path, &header, records, 16) && "Could not read trace file");
+    assert(header.magic == MAGIC_TRACE_MAGIC && header.capacity == 16 && header.next == 5);
+
+    assert(MAGIC_TRACE_OP(&records[0]) == MAGIC_TRACE_MALLOC && MAGIC_TRACE_SIZE(&records[0]) == 100);
+    assert(MAGIC_TRACE_OP(&records[1]) == MAGIC_TRACE_CALLOC && MAGIC_TRACE_SIZE(&records[1]) == 32);
+    assert(MAGIC_TRACE_OP(&records[2]) == MAGIC_TRACE_REALLOC && records[2].old_id == records[0].id && "Realloc lost its handle");
+    assert(MAGIC_TRACE_OP(&records[3]) == MAGIC_TRACE_FREE && records[3].id == records[1].id);
+    assert(MAGIC_TRACE_OP(&records[4]) == MAGIC_TRACE_FREE && records[4].id == records[2].id);
+    assert(records[0].id != 0 && records[0].id != records[1].id && "Handles not distinct");
+    assert(records[0].timestamp <= records[4].timestamp);
+
+    // Large blocks live outside the pool and get handles of their own
+    magic_pool_set_mmap_threshold(magic_default_pool(), 64 * 1024);
+    assert(magic_trace_start(path, 16) == 0);
+    void* small = magic_malloc(100);
+    void* large = magic_malloc(256 * 1024);
+    assert(large && ((char*)large < memory_pool || (char*)large >= memory_pool + sizeof(memory_pool)));
+    void* larger = magic_realloc(large, 512 * 1024);
+    magic_free(larger);
+    magic_free(small);
+    magic_trace_stop();
+    magic_pool_set_mmap_threshold(magic_default_pool(), 0);
+
+    assert(read_trace(path, &header, records, 16) && header.next == 5);
+    assert(!(records[0].id & MAGIC_TRACE_LARGE_ID) && "Pool block tagged as large");
+    assert((records[1].id & MAGIC_TRACE_LARGE_ID) && "Large block not tagged");
+    assert(records[1].id != records[0].id);
+    assert(records[2].old_id == records[1].id && "Large realloc lost its handle");
+    assert(records[3].id == records[2].id && records[4].id == records[0].id);
+    remove(path);
+
+    TEST_SUCCESS("Trace Records");
+    visualize_memory_pool();
+    clear_memory_pool();
+}
+
+void test_trace_ring_wraps() {
+    TEST_START("Trace Ring Wraps");
+
+    const char* path = "magic_test_trace.bin";
+    initialize_memory_pool();
+    assert(magic_trace_start(path, 4) == 0);
+    for (size_t i = 1; i <= 10; i++) {
+        magic_free(magic_malloc(i * 8));
+    }
+    magic_trace_stop();
+
+    // 20 calls into 4 slots: slot i % 4 holds the newest call i
+    MagicTraceHeader header;
+    MagicTraceRecord records[4];
+    assert(read_trace(path, &header, records, 4));
+    assert(header.next == 20);
+    for (uint64_t i = 16; i < 20; i++) {
+        MagicTraceRecord* record = &records[i % 4];
+        int op = i % 2 ? MAGIC_TRACE_FREE : MAGIC_TRACE_MALLOC;
+        assert(MAGIC_TRACE_OP(record) == op && "Ring slot does not hold the newest call");
+        if (op == MAGIC_TRACE_MALLOC) {
+            assert(MAGIC_TRACE_SIZE(record) == (i / 2 + 1) * 8);
+        }
+    }
+    remove(path);
+
+    TEST_SUCCESS("Trace Ring Wraps");
+    clear_memory_pool();
+}
+
+/// ------------------------------- STATS TESTS ------------------------------- //
+
+// Recomputes by walking the heap what magic_pool_stats maintains incrementally.
+static void walk_heap(MagicPool* pool, MagicStats* expected) {
+    memset(expected, 0, sizeof(*expected));
+    for (Block* block = (Block*)pool->base; (char*)block < pool->base + pool->size;
+         block = (Block*)((char*)block + BLOCK_SIZE + GET_SIZE(block))) {
+        if (IS_FREE(block)) {
+            expected->free_bytes += GET_SIZE(block);
+            expected->free_blocks++;
+            if (GET_SIZE(block) > expected->largest_free_block) {
+                expected->largest_free_block = GET_SIZE(block);
+            }
+        }
+        else {
+            expected->bytes_in_use += GET_SIZE(block);
+        }
+    }
+}
+
+static void check_stats_match_heap(MagicPool* pool) {
+    MagicStats stats, expected;
+    magic_pool_stats(pool, &stats);
+    walk_heap(pool, &expected);
+    assert(stats.bytes_in_use == expected.bytes_in_use && "bytes_in_use drifted");
+    assert(stats.free_bytes == expected.free_bytes && "free_bytes drifted");
+    assert(stats.free_blocks == expected.free_blocks && "free_blocks drifted");
+    // Range bins answer with the size of one of their blocks, within a factor of two
+    assert(stats.largest_free_block <= expected.largest_free_block && "largest_free_block is wrong");
+    assert(stats.largest_free_block > expected.largest_free_block / 2 && "largest_free_block is wrong");
+    if (pool->mode == MAGIC_MODE_BUDDY || pool->tree) {
+        assert(stats.largest_free_block == expected.largest_free_block && "largest_free_block is not exact");
+    }
+
+    size_t classified = 0;
+    for (int i = 0; i < BIN_COUNT; i++) classified += stats.size_classes[i];
+    assert(classified == stats.allocations - stats.frees && "Histogram does not match live blocks");
+}
+
+void test_stats_track_heap() {
+    TEST_START("Stats Track Heap");
+
+    MagicPoolMode modes[] = { MAGIC_MODE_SEGREGATED, MAGIC_MODE_TLSF, MAGIC_MODE_BUDDY };
+    for (int m = 0; m < 3; m++) {
+        MagicPool* pool = magic_pool_create_mode(1024 * 1024, modes[m]);
+        void* ptrs[300];
+        srand(7);
+        for (int i = 0; i < 300; i++) {
+            ptrs[i] = magic_pool_malloc(pool, 1 + (size_t)rand() % 3000);
+        }
+        for (int i = 0; i < 300; i += 3) {
+            magic_pool_free(pool, ptrs[i]);
+            ptrs[i] = NULL;
+        }
+        for (int i = 1; i < 300; i += 3) {
+            ptrs[i] = magic_pool_realloc(pool, ptrs[i], 1 + (size_t)rand() % 6000);
+        }
+        check_stats_match_heap(pool);
+
+        MagicStats stats;
+        magic_pool_stats(pool, &stats);
+        assert(stats.allocations == 300 && stats.frees == 100 && stats.reallocs == 100);
+        assert(stats.peak_bytes_in_use >= stats.bytes_in_use);
+
+        assert(magic_pool_malloc(pool, 2 * 1024 * 1024) == NULL);
+        magic_pool_stats(pool, &stats);
+        assert(stats.failed_allocations == 1 && "Failed allocation not counted");
+
+        for (int i = 0; i < 300; i++) {
+            if (ptrs[i]) magic_pool_free(pool, ptrs[i]);
+        }
+        magic_pool_stats(pool, &stats);
+        assert(stats.bytes_in_use == 0 && stats.peak_bytes_in_use > 0);
+        check_stats_match_heap(pool);
+        assert(magic_pool_check(pool) == MAGIC_OK);
+        magic_pool_destroy(pool);
+    }
+
+    TEST_SUCCESS("Stats Track Heap");
+}
+
+void test_stats_count_cached_calls() {
+    TEST_START("Stats Count Cached Calls");
+
+    MagicPool* pool = magic_pool_create(1024 * 1024);
+    magic_pool_set_thread_cache(pool, 1);
+    for (int i = 0; i < 1000; i++) {
+        magic_pool_free(pool, magic_pool_malloc(pool, 64));
+    }
+
+    // Cached blocks are in use as far as the pool is concerned
+    MagicStats stats;
+    magic_pool_stats(pool, &stats);
+    assert(stats.allocations == 1000 && stats.frees == 1000 && "Cached calls not published");
+    assert(stats.bytes_in_use > 0 && stats.size_classes[64 / 8 - 1] > 0);
+
+    magic_thread_cache_flush();
+    magic_pool_stats(pool, &stats);
+    assert(stats.bytes_in_use == 0 && stats.free_blocks == 1 && stats.largest_free_block == stats.free_bytes);
+
+    magic_pool_destroy(pool);
+    TEST_SUCCESS("Stats Count Cached Calls");
+}
+
+/// ------------------------------- CHECK TESTS ------------------------------- //
+
+static MagicError handled_error;
+static void* handled_ptr;
+
+static void record_error(MagicPool* pool, MagicError error, void* ptr, size_t size) {
+    (void)pool; (void)size;
+    handled_error = error;
+    handled_ptr = ptr;
+}
+
+void test_error_handler() {
+    TEST_START("Error Handler");
+
+    MagicPool* pool = magic_pool_create(64 * 1024);
+    magic_set_error_handler(record_error);
+
+    void* ptr = magic_pool_malloc(pool, 100);
+    magic_pool_free(pool, ptr);
+    magic_pool_free(pool, ptr);
+    assert(handled_error == MAGIC_ERROR_DOUBLE_FREE && handled_ptr == ptr && "Double free not reported");
+    assert(magic_last_error() == MAGIC_ERROR_DOUBLE_FREE);
+
+    // Blocks waiting in the thread cache are caught too, and handed out once
+    magic_pool_set_thread_cache(pool, 1);
+    void* cached = magic_pool_malloc(pool, 48);
+    magic_pool_free(pool, cached);
+    handled_error = MAGIC_OK;
+    magic_pool_free(pool, cached);
+    assert(handled_error == MAGIC_ERROR_DOUBLE_FREE && handled_ptr == cached && "Thread cache double free not reported");
+    void* again = magic_pool_malloc(pool, 48);
+    void* next = magic_pool_malloc(pool, 48);
+    assert(again == cached && next != cached && "Double freed block handed out twice");
+    magic_pool_free(pool, again);
+    magic_pool_free(pool, next);
+    magic_pool_set_thread_cache(pool, 0);
+
+    char outside[64];
+    magic_pool_free(pool, outside + 16);
+    assert(handled_error == MAGIC_ERROR_INVALID_POINTER && "Foreign pointer not reported");
+    assert(magic_pool_realloc(pool, outside + 16, 32) == NULL && handled_error == MAGIC_ERROR_INVALID_POINTER);
+
+    assert(magic_pool_malloc(pool, 0) == NULL && handled_error == MAGIC_ERROR_INVALID_SIZE);
+    assert(magic_pool_malloc(pool, 60 * 1024) != NULL);
+    assert(magic_pool_malloc(pool, 8 * 1024) == NULL && handled_error == MAGIC_ERROR_OUT_OF_MEMORY);
+
+    // Successful calls leave the last error alone
+    assert(magic_pool_malloc(pool, 8) != NULL && magic_last_error() == MAGIC_ERROR_OUT_OF_MEMORY);
+
+    magic_set_error_handler(NULL);
+    magic_pool_destroy(pool);
+    TEST_SUCCESS("Error Handler");
+}
+
+void test_heap_check() {
+    TEST_START("Heap Check");
+
+    MagicPool* pool = magic_pool_create(64 * 1024);
+    void* a = magic_pool_malloc(pool, 100);
+    void* b = magic_pool_malloc(pool, 200);
+    void* c = magic_pool_malloc(pool, 300);
+    magic_pool_free(pool, b);
+    assert(magic_pool_check(pool) == MAGIC_OK && "Healthy heap fails the check");
+
+    // Damage the boundary tag of the free block between a and c
+    Block* hole = (Block*)((char*)b - BLOCK_SIZE);
+    size_t* footer = (size_t*)((char*)b + GET_SIZE(hole) - sizeof(size_t));
+    size_t saved = *footer;
+    *footer = 8;
+    magic_set_error_handler(record_error);
+    assert(magic_pool_check(pool) == MAGIC_ERROR_CORRUPTION && "Damaged boundary tag not found");
+    magic_set_error_handler(NULL);
+    *footer = saved;
+    assert(magic_pool_check(pool) == MAGIC_OK);
+
+    magic_pool_free(pool, a);
+    magic_pool_free(pool, c);
+    assert(magic_pool_check(pool) == MAGIC_OK);
+    magic_pool_destroy(pool);
+    TEST_SUCCESS("Heap Check");
+}
+
+/// ------------------------------- ALIGNMENT TESTS ------------------------------- //
+
+void test_memalign_returns_slack() {
+    TEST_START("Memalign Returns Slack");
+
+    MagicPool* pool = magic_pool_create(256 * 1024);
+    MagicStats before, after;
+    magic_pool_stats(pool, &before);
+
+    size_t alignments[] = { 16, 32, 64, 256, 4096 };
+    void* ptrs[5];
+    for (int i = 0; i < 5; i++) {
+        void* spacer = magic_pool_malloc(pool, 8);      // knock the next block off alignment
+        ptrs[i] = magic_pool_memalign(pool, alignments[i], 100);
+        assert(ptrs[i] != NULL && ((uintptr_t)ptrs[i] % alignments[i]) == 0 && "Payload not aligned");
+        assert(magic_pool_check(pool) == MAGIC_OK);
+        magic_pool_free(pool, spacer);
+    }
+
+    // Leading gaps went back to the free lists instead of staying inside the blocks
+    Block* block = (Block*)((char*)ptrs[4] - BLOCK_SIZE);
+    assert(GET_SIZE(block) < 4096 && PREV_IS_FREE(block) && "Leading slack was not freed");
+
+    for (int i = 0; i < 5; i++) {
+        magic_pool_free(pool, ptrs[i]);
+    }
+    magic_pool_stats(pool, &after);
+    assert(after.free_blocks == 1 && after.free_bytes == before.free_bytes && "Aligned blocks did not merge back");
+
+    assert(magic_pool_memalign(pool, 48, 100) == NULL && "Accepted a non power of two alignment");
+    magic_pool_destroy(pool);
+    TEST_SUCCESS("Memalign Returns Slack");
+}
+
+void test_posix_memalign() {
+    TEST_START("Posix Memalign");
+
+    initialize_memory_pool();
+    void* ptr = NULL;
+    assert(magic_posix_memalign(&ptr, 24, 64) == EINVAL && ptr == NULL);
+    assert(magic_posix_memalign(&ptr, 4, 64) == EINVAL);
+    assert(magic_posix_memalign(&ptr, 64, 2048) == ENOMEM);
+
+    assert(magic_posix_memalign(&ptr, 64, 200) == 0 && ((uintptr_t)ptr % 64) == 0);
+    void* aligned = magic_aligned_alloc(128, 128);
+    assert(aligned != NULL && ((uintptr_t)aligned % 128) == 0);
+
+    // magic_free takes aligned blocks like any other
+    magic_free(ptr);
+    magic_free(aligned);
+    Block* first = (Block*)memory_pool;
+    assert(IS_FREE(first) && GET_SIZE(first) == MEMORY_POOL_SIZE - BLOCK_SIZE && "Aligned blocks did not merge back");
+
+    TEST_SUCCESS("Posix Memalign");
+    visualize_memory_pool();
+    clear_memory_pool();
+}
+
+/// ------------------------------- BATCH TESTS ------------------------------- //
+
+void test_batch_contiguous() {
+    TEST_START("Batch Contiguous");
+
+    MagicPool* pool = magic_pool_create(64 * 1024);
+    MagicStats before, after;
+    magic_pool_stats(pool, &before);
+
+    void* ptrs[100];
+    assert(magic_pool_malloc_batch(pool, 48, 100, ptrs) == 100 && "Batch fell short");
+    for (int i = 0; i < 100; i++) {
+        Block* block = (Block*)ptrs[i] - 1;
+        assert(!IS_FREE(block) && GET_SIZE(block) == 48 && "Batch block has the wrong size");
+        if (i > 0) {
+            assert((char*)ptrs[i] == (char*)ptrs[i - 1] + 48 + BLOCK_SIZE && "Batch blocks are not adjacent");
+        }
+    }
+    assert(magic_pool_check(pool) == MAGIC_OK);
+    magic_pool_stats(pool, &after);
+    assert(after.allocations == before.allocations + 100 && after.bytes_in_use == 100 * 48);
+
+    // Free in a scrambled order, with holes of still allocated blocks in between
+    void* kept[10];
+    void* rest[90];
+    int k = 0, r = 0;
+    for (int i = 0; i < 100; i++) {
+        int j = (i * 37) % 100;
+        if (j % 10 == 5) kept[k++] = ptrs[j];
+        else rest[r++] = ptrs[j];
+    }
+    magic_pool_free_batch(pool, rest, 90);
+    assert(magic_pool_check(pool) == MAGIC_OK);
+    magic_pool_stats(pool, &after);
+    assert(after.bytes_in_use == 10 * 48 && after.frees == before.frees + 90);
+
+    magic_pool_free_batch(pool, kept, 10);
+    magic_pool_stats(pool, &after);
+    assert(after.free_blocks == 1 && after.free_bytes == before.free_bytes && "Batch did not merge back");
+
+    magic_pool_destroy(pool);
+    TEST_SUCCESS("Batch Contiguous");
+}
+
+void test_batch_partial() {
+    TEST_START("Batch Partial");
+
+    initialize_memory_pool();
+    void* ptrs[20];
+    size_t count = magic_malloc_batch(48, 20, ptrs);
+    assert(count > 0 && count < 20 && "Default pool cannot hold the whole batch");
+    for (size_t i = count; i < 20; i++) {
+        assert(ptrs[i] == NULL && "Unfilled entry was not cleared");
+    }
+
+    // NULL entries are skipped, so the whole array can be handed back
+    magic_free_batch(ptrs, 20);
+    Block* first = (Block*)memory_pool;
+    assert(IS_FREE(first) && GET_SIZE(first) == MEMORY_POOL_SIZE - BLOCK_SIZE && "Batch did not merge back");
+
+    TEST_SUCCESS("Batch Partial");
+    visualize_memory_pool();
+    clear_memory_pool();
+}
+
+/// ------------------------------- GROWTH TESTS ------------------------------- //
+
+void test_growable_pool() {
+    TEST_START("Growable Pool");
+
+    MagicPool* pool = magic_pool_create_growable(64 * 1024, 1024 * 1024);
+    assert(pool != NULL);
+    size_t initial = pool->size;
+
+    // Far more than the initial commit; earlier blocks must not move
+    char* ptrs[100];
+    for (int i = 0; i < 100; i++) {
+        ptrs[i] = magic_pool_malloc(pool, 4000);
+        assert(ptrs[i] != NULL && "Growable pool did not grow");
+        memset(ptrs[i], i, 4000);
+    }
+    assert(pool->size > initial && pool->size <= pool->max_size);
+    assert(magic_pool_check(pool) == MAGIC_OK);
+    for (int i = 0; i < 100; i++) {
+        assert(ptrs[i][0] == (char)i && ptrs[i][3999] == (char)i && "Block contents changed while growing");
+    }
+    assert(magic_pool_malloc(pool, 2 * 1024 * 1024) == NULL && "Grew past max_size");
+
+    for (int i = 0; i < 100; i++) {
+        magic_pool_free(pool, ptrs[i]);
+    }
+    MagicStats stats;
+    magic_pool_stats(pool, &stats);
+    assert(stats.free_blocks == 1 && stats.free_bytes == pool->size - BLOCK_SIZE && "Grown chunks did not merge");
+
+    magic_pool_destroy(pool);
+    TEST_SUCCESS("Growable Pool");
+}
+
+void test_growable_tail_merge() {
+    TEST_START("Growable Tail Merge");
+
+    MagicPool* pool = magic_pool_create_growable(64 * 1024, 1024 * 1024);
+    void* spacer = magic_pool_malloc(pool, 1000);
+    assert(pool->tail_free && "Tail after the spacer should be free");
+
+    // The free tail and the new memory form one block, so the request is
+    // served right after the spacer
+    void* big = magic_pool_malloc(pool, 100000);
+    assert(big == (char*)spacer + 1000 + BLOCK_SIZE && "Growth did not merge with the free tail");
+    assert(magic_usable_size(big) >= 100000 && magic_usable_size(NULL) == 0);
+    assert(magic_pool_check(pool) == MAGIC_OK);
+
+    // Filling the pool to its last byte leaves an allocated tail
+    magic_pool_free(pool, big);
+    big = magic_pool_malloc(pool, pool->size - 2 * BLOCK_SIZE - 1000);
+    assert(big != NULL && !pool->tail_free);
+    magic_pool_free(pool, big);
+    magic_pool_free(pool, spacer);
+    assert(pool->tail_free && magic_pool_check(pool) == MAGIC_OK);
+
+    magic_pool_destroy(pool);
+    TEST_SUCCESS("Growable Tail Merge");
+}
+
+/// ------------------------------- LARGE BLOCK TESTS ------------------------------- //
+
+void test_large_blocks_bypass_pool() {
+    TEST_START("Large Blocks Bypass Pool");
+
+    MagicPool* pool = magic_pool_create(256 * 1024);
+    magic_pool_set_mmap_threshold(pool, 64 * 1024);
+    MagicStats before, stats;
+    magic_pool_stats(pool, &before);
+
+    char* big = magic_pool_malloc(pool, 100000);
+    char* small = magic_pool_malloc(pool, 100);
+    assert(big != NULL && IS_MMAPPED((Block*)big - 1) && "Large request was served by the pool");
+    assert(small != NULL && !IS_MMAPPED((Block*)small - 1));
+    assert(magic_pool_owns(pool, big) && magic_pool_owns(pool, small) && magic_usable_size(big) >= 100000);
+    memset(big, 0x5a, 100000);
+
+    // The pool's free block is only cut by the small request
+    magic_pool_stats(pool, &stats);
+    assert(stats.free_bytes > before.free_bytes - 200 && stats.mapped_bytes >= 100000 + BLOCK_SIZE);
+    assert(stats.bytes_in_use == magic_usable_size(big) + magic_usable_size(small));
+    assert(magic_pool_check(pool) == MAGIC_OK);
+
+    // Fresh mappings come zeroed; larger than the pool itself is fine
+    char* zeroed = magic_pool_calloc(pool, 1024, 1024);
+    assert(zeroed != NULL && zeroed[0] == 0 && zeroed[1024 * 1024 - 1] == 0);
+
+    magic_pool_free(pool, big);
+    magic_pool_free(pool, zeroed);
+    magic_pool_free(pool, small);
+    magic_pool_stats(pool, &stats);
+    assert(stats.mapped_bytes == 0 && stats.bytes_in_use == 0 && stats.frees == before.frees + 3);
+
+    magic_pool_destroy(pool);
+    TEST_SUCCESS("Large Blocks Bypass Pool");
+}
+
+void test_large_realloc() {
+    TEST_START("Large Realloc");
+
+    MagicPool* pool = magic_pool_create(256 * 1024);
+    magic_pool_set_mmap_threshold(pool, 64 * 1024);
+    MagicStats stats;
+
+    char* ptr = magic_pool_malloc(pool, 100000);
+    for (int i = 0; i < 100000; i++) ptr[i] = (char)(i % 251);
+
+    // Grows past the pool size without copying through the pool
+    ptr = magic_pool_realloc(pool, ptr, 4 * 1024 * 1024);
+    assert(ptr != NULL && IS_MMAPPED((Block*)ptr - 1) && ptr[99999] == (char)(99999 % 251));
+    ptr[4 * 1024 * 1024 - 1] = 1;
+
+    // Shrinking hands the tail back to the OS right away
+    ptr = magic_pool_realloc(pool, ptr, 80000);
+    magic_pool_stats(pool, &stats);
+    assert(ptr != NULL && stats.mapped_bytes < 84 * 1024 && ptr[79999] == (char)(79999 % 251));
+
+    // Below the threshold it moves into the pool, and back out past it
+    ptr = magic_pool_realloc(pool, ptr, 1000);
+    assert(ptr != NULL && !IS_MMAPPED((Block*)ptr - 1) && ptr[999] == (char)(999 % 251));
+    magic_pool_stats(pool, &stats);
+    assert(stats.mapped_bytes == 0);
+    ptr = magic_pool_realloc(pool, ptr, 70000);
+    assert(ptr != NULL && IS_MMAPPED((Block*)ptr - 1) && ptr[999] == (char)(999 % 251));
+    assert(magic_pool_check(pool) == MAGIC_OK);
+
+#if MAGIC_CHECK_LEVEL >= MAGIC_CHECK_CHECKED
+    // A large block freed through another pool or freed twice is reported, not followed
+    magic_set_error_handler(record_error);
+    MagicPool* other = magic_pool_create(64 * 1024);
+    handled_error = MAGIC_OK;
+    magic_pool_free(other, ptr);
+    assert(handled_error == MAGIC_ERROR_INVALID_POINTER && "Large block freed through another pool");
+    magic_pool_destroy(other);
+    magic_pool_free(pool, ptr);
+    handled_error = MAGIC_OK;
+    magic_pool_free(pool, ptr);
+    assert(handled_error == MAGIC_ERROR_INVALID_POINTER && "Large block freed twice");
+    magic_set_error_handler(NULL);
+    ptr = magic_pool_malloc(pool, 70000);
+#endif
+
+    // Destroying the pool unmaps the large blocks it still holds
+    magic_pool_destroy(pool);
+    TEST_SUCCESS("Large Realloc");
+}
+
+/// ------------------------------- PURGE TESTS ------------------------------- //
+
+// Pages of [ptr, ptr + size) that are backed by physical memory.
+static size_t resident_pages(void* ptr, size_t size) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start = ((uintptr_t)ptr + page - 1) & ~(uintptr_t)(page - 1);
+    size_t pages = ((uintptr_t)ptr + size - start) / page;
+    static unsigned char resident[1024];
+    assert(pages <= sizeof(resident));
+    mincore((void*)start, pages * page, resident);
+    size_t count = 0;
+    for (size_t i = 0; i < pages; i++) {
+        count += resident[i] & 1;
+    }
+    return count;
+}
+
+void test_trim_purges_free_pages() {
+    TEST_START("Trim Purges Free Pages");
+
+    MagicPool* pool = magic_pool_create(4 * 1024 * 1024);
+    char* big = magic_pool_malloc(pool, 2 * 1024 * 1024);
+    char* small = magic_pool_malloc(pool, 100);
+    memset(big, 0xab, 2 * 1024 * 1024);
+    magic_pool_free(pool, big);
+
+    // Everything but the pages holding block metadata goes back to the OS
+    MagicStats stats;
+    size_t purged = magic_pool_trim(pool);
+    magic_pool_stats(pool, &stats);
+    assert(purged >= 2 * 1024 * 1024 / 4096 - 2 && "Free pages were not purged");
+    assert(stats.purged_pages == purged && stats.purged_pages_total == purged);
+    assert(magic_pool_trim(pool) == 0 && "Purged pages were purged again");
+    assert(magic_pool_check(pool) == MAGIC_OK);
+
+    // Reusing a purged block takes its pages off the count; the memory is usable as ever
+    big = magic_pool_malloc(pool, 2 * 1024 * 1024);
+    assert(big != NULL);
+    memset(big, 0xcd, 2 * 1024 * 1024);
+    magic_pool_stats(pool, &stats);
+    assert(stats.purged_pages < purged && stats.purged_pages_total == purged);
+
+    magic_pool_free(pool, big);
+    magic_pool_free(pool, small);
+    assert(magic_pool_check(pool) == MAGIC_OK);
+
+    // Caller-owned memory is never purged
+    initialize_memory_pool();
+    assert(magic_trim() == 0);
+
+    magic_pool_destroy(pool);
+    TEST_SUCCESS("Trim Purges Free Pages");
+}
+
+void test_purged_merge_count() {
+    TEST_START("Purged Merge Count");
+
+    // Two purged blocks merged through a small block freed between them
+    MagicPool* pool = magic_pool_create(2 * 1024 * 1024);
+    size_t size = 256 * 1024;
+    char* left = magic_pool_malloc(pool, size);
+    char* middle = magic_pool_malloc(pool, 100);
+    char* right = magic_pool_malloc(pool, size);
+    char* wall = magic_pool_malloc(pool, 100);
+    memset(left, 0xab, size);
+    memset(right, 0xab, size);
+    magic_pool_free(pool, left);
+    magic_pool_free(pool, right);
+    assert(magic_pool_trim(pool) > 0);
+    magic_pool_free(pool, middle);
+
+    // Every page counted as purged is one the OS really has back, and the
+    // other way round: all heap pages outside purged blocks were written
+    MagicStats stats;
+    magic_pool_stats(pool, &stats);
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    uintptr_t first = ((uintptr_t)pool->base + page - 1) & ~(uintptr_t)(page - 1);
+    size_t pages = ((uintptr_t)pool->base + pool->size - first) / page;
+    assert(stats.purged_pages == pages - resident_pages(pool->base, pool->size) && "Purged pages miscounted after merge");
+    assert(magic_pool_trim(pool) == 0 && magic_pool_check(pool) == MAGIC_OK);
+
+    magic_pool_free(pool, wall);
+    magic_pool_destroy(pool);
+    TEST_SUCCESS("Purged Merge Count");
+}
+
+static void wait_seconds(double seconds) {
+    double start = now_seconds();
+    while (now_seconds() - start < seconds) {}
+}
+
+void test_purge_decay() {
+    TEST_START("Purge Decay");
+
+    MagicPool* pool = magic_pool_create_mode(4 * 1024 * 1024, MAGIC_MODE_TLSF);
+    char* keep = magic_pool_malloc(pool, 100);
+    magic_pool_set_purge_decay(pool, 20);
+    char* big = magic_pool_malloc(pool, 1024 * 1024);
+    memset(big, 0xab, 1024 * 1024);
+    magic_pool_free(pool, big);
+
+    // Nothing is purged before the block has been free for a full epoch
+    MagicStats stats;
+    void* ptr = magic_pool_malloc(pool, 64);
+    magic_pool_free(pool, ptr);
+    magic_pool_stats(pool, &stats);
+    assert(stats.purged_pages == 0 && "Purged a block that was just freed");
+
+    for (int epoch = 0; epoch < 2; epoch++) {
+        wait_seconds(0.025);
+        ptr = magic_pool_malloc(pool, 64);
+        magic_pool_free(pool, ptr);
+    }
+    magic_pool_stats(pool, &stats);
+    assert(stats.purged_pages >= 1024 * 1024 / 4096 && "Unused pages were not purged after decay");
+    assert(magic_pool_check(pool) == MAGIC_OK);
+
+    magic_pool_free(pool, keep);
+    magic_pool_destroy(pool);
+    TEST_SUCCESS("Purge Decay");
+}
+
+/// -------------------------------- FIT TESTS -------------------------------- //
+
+void test_best_fit() {
+    TEST_START("Best Fit");
+
+    MagicPool* pool = magic_pool_create(1024 * 1024);
+    assert(magic_pool_set_fit(pool, MAGIC_FIT_BEST) == 0);
+
+    // Holes of 600, 400 and 300 bytes, kept apart by live blocks
+    void* holes[3];
+    void* walls[3];
+    size_t sizes[3] = { 600, 400, 300 };
+    for (int i = 0; i < 3; i++) {
+        holes[i] = magic_pool_malloc(pool, sizes[i]);
+        walls[i] = magic_pool_malloc(pool, 32);
+    }
+    for (int i = 2; i >= 0; i--) {
+        magic_pool_free(pool, holes[i]);
+    }
+    assert(magic_pool_check(pool) == MAGIC_OK);
+
+    // The smallest hole that fits wins, though the 400 byte one heads the bin
+    void* ptr = magic_pool_malloc(pool, 280);
+    assert(ptr == holes[2] && "Best fit did not take the smallest hole");
+    void* big = magic_pool_malloc(pool, 500);
+    assert(big == holes[0] && "Best fit did not take the only hole that fits");
+    void* small = magic_pool_malloc(pool, 16);
+    assert((char*)small < (char*)walls[2] && "Best fit split the tail instead of a hole");
+    assert(magic_pool_check(pool) == MAGIC_OK);
+
+    // Placement is only selectable for segregated pools
+    MagicPool* tlsf = magic_pool_create_mode(64 * 1024, MAGIC_MODE_TLSF);
+    assert(magic_pool_set_fit(tlsf, MAGIC_FIT_BEST) == -1);
+    magic_pool_destroy(tlsf);
+
+    magic_pool_destroy(pool);
+    TEST_SUCCESS("Best Fit");
+}
+
+void test_next_fit_and_switching() {
+    TEST_START("Next Fit And Switching");
+
+    MagicPool* pool = magic_pool_create(1024 * 1024);
+    assert(magic_pool_set_fit(pool, MAGIC_FIT_NEXT) == 0);
+
+    // The search resumes after the last split instead of reusing the hole at the base
+    void* blocks[16];
+    for (int i = 0; i < 16; i++) {
+        blocks[i] = magic_pool_malloc(pool, 64 + 48 * i);
+    }
+    magic_pool_free(pool, blocks[0]);
+    void* ptr = magic_pool_malloc(pool, 64);
+    assert((char*)ptr > (char*)blocks[15] && "Next fit went back to the start of the heap");
+    assert(magic_pool_check(pool) == MAGIC_OK);
+
+    // Free blocks are reindexed whenever the policy changes
+    for (int i = 1; i < 16; i += 2) {
+        magic_pool_free(pool, blocks[i]);
+    }
+    MagicFitPolicy policies[] = { MAGIC_FIT_BEST, MAGIC_FIT_NEXT, MAGIC_FIT_FIRST, MAGIC_FIT_BEST };
+    for (int i = 0; i < 4; i++) {
+        assert(magic_pool_set_fit(pool, policies[i]) == 0);
+        assert(magic_pool_check(pool) == MAGIC_OK && "Switching policy broke the free lists");
+        void* probe = magic_pool_malloc(pool, 100 * (i + 1));
+        assert(probe != NULL);
+        magic_pool_free(pool, probe);
+    }
+
+    magic_pool_free(pool, ptr);
+    for (int i = 2; i < 16; i += 2) {
+        magic_pool_free(pool, blocks[i]);
+    }
+    MagicStats stats;
+    magic_pool_stats(pool, &stats);
+    assert(stats.free_blocks == 1 && "Free blocks were not merged back into one");
+    assert(magic_pool_check(pool) == MAGIC_OK);
+
+    // Purged blocks stay purged, and counted, across a switch
+    size_t purged = magic_pool_trim(pool);
+    assert(purged > 0);
+    assert(magic_pool_set_fit(pool, MAGIC_FIT_BEST) == 0);
+    magic_pool_stats(pool, &stats);
+    assert(stats.purged_pages == purged && "Switching policy lost the purged pages");
+    assert(magic_pool_trim(pool) == 0 && "Switching policy made purged pages look resident");
+    assert(magic_pool_set_fit(pool, MAGIC_FIT_FIRST) == 0);
+    magic_pool_stats(pool, &stats);
+    assert(stats.purged_pages == purged && magic_pool_trim(pool) == 0);
+
+    magic_pool_destroy(pool);
+    TEST_SUCCESS("Next Fit And Switching");
+}
+
+/// ------------------------------- ARENA TESTS ------------------------------- //
+
+void test_arena_bump_and_reset() {
+    TEST_START("Arena Bump And Reset");
+
+    MagicPool* pool = magic_pool_create(1024 * 1024);
+    MagicStats before, stats;
+    magic_pool_stats(pool, &before);
+    MagicArena* arena = magic_arena_create(pool, 1024);
+    assert(arena != NULL);
+
+    // Allocations within a chunk are adjacent and aligned, and take no pool calls
+    char* ptrs[200];
+    for (int i = 0; i < 200; i++) {
+        ptrs[i] = magic_arena_alloc(arena, 20);
+        assert(ptrs[i] != NULL && (uintptr_t)ptrs[i] % MAGIC_ALIGNMENT == 0);
+        memset(ptrs[i], i, 20);
+    }
+    assert(ptrs[1] == ptrs[0] + 24 && "Arena allocations were not bumped");
+    for (int i = 0; i < 200; i++) {
+        assert(ptrs[i][19] == (char)i && "Arena allocations overlap");
+    }
+    magic_pool_stats(pool, &stats);
+    assert(stats.allocations - before.allocations < 8 && "Arena allocated every request from the pool");
+
+    // A request larger than a chunk gets a chunk of its own
+    char* big = magic_arena_alloc(arena, 64 * 1024);
+    assert(big != NULL);
+    memset(big, 0xab, 64 * 1024);
+    assert(magic_arena_alloc(arena, 0) == NULL);
+
+    // Reset keeps only the newest chunk, and reuses it from its start
+    magic_arena_reset(arena);
+    magic_pool_stats(pool, &stats);
+    size_t kept = stats.bytes_in_use;
+    assert(magic_arena_alloc(arena, 100) == big && "Reset did not reuse the newest chunk");
+    magic_pool_stats(pool, &stats);
+    assert(stats.bytes_in_use == kept);
+    assert(magic_pool_check(pool) == MAGIC_OK);
+
+    magic_arena_destroy(arena);
+    magic_pool_stats(pool, &stats);
+    assert(stats.bytes_in_use == before.bytes_in_use && stats.free_blocks == 1 && "Destroy left chunks behind");
+
+    magic_pool_destroy(pool);
+    TEST_SUCCESS("Arena Bump And Reset");
+}
+
+void test_arena_mark_rewind() {
+    TEST_START("Arena Mark Rewind");
+
+    MagicArena* arena = magic_arena_create(NULL, 64);
+    assert(arena != NULL);
+    char* first = magic_arena_alloc(arena, 16);
+    assert(first != NULL);
+
+    // Rewinding frees everything since the mark, chunks started since included
+    MagicStats at_mark, stats;
+    magic_stats(&at_mark);
+    MagicArenaMark mark = magic_arena_mark(arena);
+    char* after = magic_arena_alloc(arena, 16);
+    for (int i = 0; i < 20; i++) {
+        assert(magic_arena_alloc(arena, 32) != NULL);
+    }
+    magic_stats(&stats);
+    assert(stats.bytes_in_use > at_mark.bytes_in_use);
+    magic_arena_rewind(arena, mark);
+    magic_stats(&stats);
+    assert(stats.bytes_in_use == at_mark.bytes_in_use && "Rewind kept chunks started after the mark");
+    assert(magic_arena_alloc(arena, 16) == after && "Rewind did not restore the bump pointer");
+
+    // A mark of an empty arena rewinds it completely
+    MagicArena* empty = magic_arena_create(NULL, 64);
+    MagicArenaMark start = magic_arena_mark(empty);
+    assert(magic_arena_alloc(empty, 40) != NULL);
+    magic_arena_rewind(empty, start);
+    assert(empty->chunk == NULL);
+    magic_arena_destroy(empty);
+
+    magic_arena_destroy(arena);
+    assert(magic_pool_check(magic_default_pool()) == MAGIC_OK);
+
+    visualize_memory_pool();
+    clear_memory_pool();
+    TEST_SUCCESS("Arena Mark Rewind");
+}
+
+/// ------------------------------- SHARD TESTS ------------------------------- //
+
+typedef struct ShardWork {
+    MagicShardedPool* sharded;
+    void* ptrs[32];
+    MagicPool* local;
+} ShardWork;
+
+static void* shard_thread(void* arg) {
+    ShardWork* work = (ShardWork*)arg;
+    work->local = magic_sharded_pool_local(work->sharded);
+    for (int i = 0; i < 32; i++) {
+        work->ptrs[i] = magic_sharded_pool_malloc(work->sharded, 16 + 24 * i);
+        memset(work->ptrs[i], i, 16 + 24 * i);
+    }
+    return NULL;
+}
+
+void test_sharded_pool_routing() {
+    TEST_START("Sharded Pool Routing");
+
+    MagicShardedPool* sharded = magic_sharded_pool_create(1024 * 1024, 4, MAGIC_SHARD_THREAD);
+    assert(sharded != NULL && sharded->count == 4);
+
+    // Threads allocate from shards of their own
+    ShardWork work[4];
+    pthread_t threads[4];
+    for (int i = 0; i < 4; i++) {
+        work[i].sharded = sharded;
+        pthread_create(&threads[i], NULL, shard_thread, &work[i]);
+        pthread_join(threads[i], NULL);
+    }
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < i; j++) {
+            assert(work[i].local != work[j].local && "Round-robin threads shared a shard");
+        }
+        for (int j = 0; j < 32; j++) {
+            assert(magic_sharded_pool_owner(sharded, work[i].ptrs[j]) == work[i].local && "Block came from another shard");
+        }
+    }
+
+    // Another thread's frees go back to the owning shard
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 32; j++) {
+            magic_sharded_pool_free(sharded, work[i].ptrs[j]);
+        }
+    }
+    for (unsigned i = 0; i < sharded->count; i++) {
+        MagicStats stats;
+        magic_pool_stats(sharded->shards[i], &stats);
+        assert(stats.bytes_in_use == 0 && stats.free_blocks == 1 && "Frees were not routed to their shard");
+        assert(magic_pool_check(sharded->shards[i]) == MAGIC_OK);
+    }
+    int local = 0;
+    assert(magic_sharded_pool_owner(sharded, &local) == NULL);
+
+    magic_sharded_pool_destroy(sharded);
+    TEST_SUCCESS("Sharded Pool Routing");
+}
+
+void test_sharded_pool_spill() {
+    TEST_START("Sharded Pool Spill");
+
+    MagicShardedPool* sharded = magic_sharded_pool_create(256 * 1024, 2, MAGIC_SHARD_CPU);
+    assert(sharded != NULL);
+    MagicPool* local = magic_sharded_pool_local(sharded);
+
+    // Once the local shard is full, allocations come from the other one
+    void* ptrs[64];
+    int spilled = 0;
+    for (int i = 0; i < 64; i++) {
+        ptrs[i] = magic_sharded_pool_malloc(sharded, 3000);
+        assert(ptrs[i] != NULL && "Sharded pool failed with a shard to spare");
+        spilled += magic_sharded_pool_owner(sharded, ptrs[i]) != local;
+    }
+    assert(spilled > 0 && "Allocations never left the local shard");
+
+    // A block grows in place in its own shard while there is room
+    void* last = ptrs[63];
+    MagicPool* owner = magic_sharded_pool_owner(sharded, last);
+    memset(last, 0x5a, 3000);
+    ptrs[63] = magic_sharded_pool_realloc(sharded, last, 6000);
+    assert(ptrs[63] != NULL && ((unsigned char*)ptrs[63])[2999] == 0x5a);
+    assert(magic_sharded_pool_owner(sharded, ptrs[63]) == owner);
+
+    for (int i = 0; i < 64; i++) {
+        magic_sharded_pool_free(sharded, ptrs[i]);
+    }
+    for (unsigned i = 0; i < sharded->count; i++) {
+        MagicStats stats;
+        magic_pool_stats(sharded->shards[i], &stats);
+        assert(stats.bytes_in_use == 0);
+    }
+
+    magic_sharded_pool_destroy(sharded);
+    TEST_SUCCESS("Sharded Pool Spill");
+}
+
+/// ------------------------------- SLAB TESTS ------------------------------- //
+
+void test_slab_alloc_free() {
+    TEST_START("Slab Alloc Free");
+
+    MagicPool* pool = magic_pool_create(1024 * 1024);
+    assert(magic_slab_create(pool, 0) == NULL);
+    assert(magic_slab_create(pool, 100000) == NULL && "Created a cache of objects larger than a slab");
+    MagicSlabCache* cache = magic_slab_create(pool, 20);
+    assert(cache != NULL && cache->object_size == 24);
+
+    // Objects are packed without headers, across several slabs
+    static char* ptrs[6000];
+    for (int i = 0; i < 6000; i++) {
+        ptrs[i] = magic_slab_alloc(cache);
+        assert(ptrs[i] != NULL && (uintptr_t)ptrs[i] % MAGIC_ALIGNMENT == 0);
+        memset(ptrs[i], (char)i, 24);
+    }
+    assert(ptrs[2] == ptrs[1] + 24 && "Slab objects were not packed");
+    for (int i = 0; i < 6000; i++) {
+        assert(ptrs[i][0] == (char)i && ptrs[i][23] == (char)i && "Slab objects overlap");
+    }
+    MagicStats stats;
+    magic_pool_stats(pool, &stats);
+    assert(stats.allocations < 8 && "Objects were allocated from the pool one by one");
+
+    // Freed objects are reused last in, first out
+    magic_slab_free(cache, ptrs[10]);
+    magic_slab_free(cache, ptrs[4000]);
+    assert(magic_slab_alloc(cache) == ptrs[4000]);
+    assert(magic_slab_alloc(cache) == ptrs[10]);
+    for (int i = 0; i < 6000; i++) {
+        magic_slab_free(cache, ptrs[i]);
+    }
+    assert(magic_pool_check(pool) == MAGIC_OK);
+
+    magic_slab_destroy(cache);
+    magic_pool_stats(pool, &stats);
+    assert(stats.bytes_in_use == 0 && "Destroy left slabs behind");
+    assert(magic_pool_check(pool) == MAGIC_OK);
+
+    magic_pool_destroy(pool);
+    TEST_SUCCESS("Slab Alloc Free");
+}
+
+typedef struct SlabWork {
+    MagicSlabCache* cache;
+    uint64_t tag;
+    void** handoff;             // objects freed by the next thread over
+} SlabWork;
+
+static void* slab_thread(void* arg) {
+    SlabWork* work = (SlabWork*)arg;
+    uint64_t* window[64] = { NULL };
+    for (int step = 0; step < 20000; step++) {
+        int slot = step % 64;
+        if (window[slot]) {
+            assert(window[slot][0] == work->tag + (uint64_t)slot && window[slot][1] == work->tag && "Slab object was handed out twice");
+            magic_slab_free(work->cache, window[slot]);
+        }
+        window[slot] = magic_slab_alloc(work->cache);
+        assert(window[slot] != NULL);
+        window[slot][0] = work->tag + (uint64_t)slot;
+        window[slot][1] = work->tag;
+    }
+    for (int slot = 0; slot < 64; slot++) {
+        work->handoff[slot] = window[slot];
+    }
+    return NULL;
+}
+
+void test_slab_threads() {
+    TEST_START("Slab Threads");
+
+    MagicPool* pool = magic_pool_create(4 * 1024 * 1024);
+    MagicSlabCache* cache = magic_slab_create(pool, 16);
+
+    enum { THREADS = 4 };
+    pthread_t threads[THREADS];
+    SlabWork work[THREADS];
+    void* handoff[THREADS][64];
+    for (int i = 0; i < THREADS; i++) {
+        work[i].cache = cache;
+        work[i].tag = (uint64_t)(i + 1) << 32;
+        work[i].handoff = handoff[i];
+        pthread_create(&threads[i], NULL, slab_thread, &work[i]);
+    }
+    for (int i = 0; i < THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    // Objects can be freed by threads other than the one that allocated them
+    for (int i = 0; i < THREADS; i++) {
+        for (int slot = 0; slot < 64; slot++) {
+            magic_slab_free(cache, handoff[i][slot]);
+        }
+    }
+
+    // Every object is back on the stack exactly once
+    size_t capacity = cache->slab_count * cache->slab_objects;
+    for (size_t i = 0; i < capacity; i++) {
+        uint64_t* object = magic_slab_alloc(cache);
+        assert(object[1] != 0xdeadbeef && "Slab object was on the free stack twice");
+        object[1] = 0xdeadbeef;
+    }
+    assert((uint32_t)cache->head == 0 && "Slab objects were lost");
+    assert(magic_pool_check(pool) == MAGIC_OK);
+
+    magic_slab_destroy(cache);
+    magic_pool_destroy(pool);
+    TEST_SUCCESS("Slab Threads");
+}
+
+/// ------------------------------- FAST BIN TESTS ------------------------------- //
+
+void test_fast_bin_reuse() {
+    TEST_START("Fast Bin Reuse");
+
+    MagicPool* pool = magic_pool_create(64 * 1024);
+    assert(magic_pool_set_fast_bins(pool, 1) == 0);
+    void* a = magic_pool_malloc(pool, 64);
+    void* wall = magic_pool_malloc(pool, 64);
+
+    // A small free waits uncoalesced and comes straight back for its size
+    MagicStats before, stats;
+    magic_pool_stats(pool, &before);
+    magic_pool_free(pool, a);
+    magic_pool_stats(pool, &stats);
+    assert(stats.free_blocks == before.free_blocks && pool->fast_count == 1 && "Small free was coalesced");
+    assert(stats.bytes_in_use == before.bytes_in_use - 64);
+    assert(magic_pool_malloc(pool, 60) == a && "Fast bin block was not reused");
+    assert(magic_pool_check(pool) == MAGIC_OK);
+
+#if MAGIC_CHECK_LEVEL >= MAGIC_CHECK_CHECKED
+    // Blocks waiting in fast bins are still caught when freed twice
+    magic_set_error_handler(record_error);
+    magic_pool_free(pool, a);
+    magic_pool_free(pool, a);
+    assert(handled_error == MAGIC_ERROR_DOUBLE_FREE && handled_ptr == a && pool->fast_count == 1);
+    handled_error = MAGIC_OK;
+    void* batch[1] = {a};
+    magic_pool_free_batch(pool, batch, 1);
+    assert(handled_error == MAGIC_ERROR_DOUBLE_FREE && pool->fast_count == 1 && "Batch freed a fast bin block");
+    assert(magic_pool_check(pool) == MAGIC_OK);
+    magic_set_error_handler(NULL);
+    a = magic_pool_malloc(pool, 64);
+#endif
+
+    // Buddy pools have no fast bins
+    MagicPool* buddy = magic_pool_create_mode(64 * 1024, MAGIC_MODE_BUDDY);
+    assert(magic_pool_set_fast_bins(buddy, 1) == -1);
+    magic_pool_destroy(buddy);
+
+    magic_pool_free(pool, a);
+    magic_pool_free(pool, wall);
+    magic_pool_destroy(pool);
+    TEST_SUCCESS("Fast Bin Reuse");
+}
+
+void test_fast_bin_consolidation() {
+    TEST_START("Fast Bin Consolidation");
+
+    MagicPool* pool = magic_pool_create(64 * 1024);
+    magic_pool_set_fast_bins(pool, 1);
+    static void* ptrs[1100];
+
+    // A request nothing free can hold merges the fast blocks first
+    for (int i = 0; i < 1000; i++) {
+        ptrs[i] = magic_pool_malloc(pool, 40);
+        assert(ptrs[i] != NULL);
+    }
+    for (int i = 0; i < 1000; i++) {
+        magic_pool_free(pool, ptrs[i]);
+    }
+    assert(pool->fast_count == 1000);
+    void* big = magic_pool_malloc(pool, 40000);
+    assert(big != NULL && "Fast blocks were not consolidated for a large request");
+    assert(pool->fast_count == 0 && magic_pool_check(pool) == MAGIC_OK);
+    magic_pool_free(pool, big);
+
+    // So does holding too many
+    for (int i = 0; i < 1100; i++) {
+        ptrs[i] = magic_pool_malloc(pool, 16);
+    }
+    for (int i = 0; i < 1100; i++) {
+        magic_pool_free(pool, ptrs[i]);
+    }
+    assert(pool->fast_count < 1100 && "Fast bins grew past their limit");
+    assert(magic_pool_check(pool) == MAGIC_OK);
+
+    // Turning them off merges what is left and gives back the bin heads
+    magic_pool_set_fast_bins(pool, 0);
+    MagicStats stats;
+    magic_pool_stats(pool, &stats);
+    assert(pool->fast_count == 0 && stats.bytes_in_use == 0 && stats.free_blocks == 1);
+    assert(magic_pool_check(pool) == MAGIC_OK);
+
+    magic_pool_destroy(pool);
+    TEST_SUCCESS("Fast Bin Consolidation");
+}
+
+/// ------------------------------- PERSISTENT POOL TESTS ------------------------------- //
+
+// Linked list node kept in a persistent pool; next is an offset from the
+// pool base plus one, as pointers do not survive reopening the file.
+typedef struct PersistNode {
+    size_t next;
+    int value;
+} PersistNode;
+
+void test_persistent_pool_reopen() {
+    TEST_START("Persistent Pool Reopen");
+
+    const char* path = "magic_test_heap.bin";
+    remove(path);
+    MagicPool* pool = magic_pool_open_file(path, 256 * 1024);
+    assert(pool != NULL && "Could not create heap file");
+    assert(magic_pool_root(pool) == NULL);
+
+    // Build a list reachable from the root
+    PersistNode* head = NULL;
+    for (int i = 0; i < 100; i++) {
+        PersistNode* node = magic_pool_malloc(pool, sizeof(PersistNode));
+        node->value = i;
+        node->next = head ? (size_t)((char*)head - pool->base) + 1 : 0;
+        head = node;
+    }
+    void* garbage = magic_pool_malloc(pool, 5000);
+    magic_pool_free(pool, garbage);
+    magic_pool_set_root(pool, head);
+    assert(magic_pool_root(pool) == head);
+    assert(magic_pool_sync(pool) == 0);
+    MagicStats before;
+    magic_pool_stats(pool, &before);
+    magic_pool_destroy(pool);
+
+    // Occupy the old address so the file is likely mapped elsewhere
+    void* blocker = mmap(NULL, 256 * 1024, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    pool = magic_pool_open_file(path, 0);
+    assert(pool != NULL && "Could not reopen heap file");
+    assert(magic_pool_check(pool) == MAGIC_OK);
+    MagicStats stats;
+    magic_pool_stats(pool, &stats);
+    assert(stats.bytes_in_use == before.bytes_in_use && stats.free_blocks == before.free_blocks);
+
+    int expected = 99;
+    for (PersistNode* node = magic_pool_root(pool); node; expected--) {
+        assert(node->value == expected && "List did not survive reopening");
+        node = node->next ? (PersistNode*)(pool->base + node->next - 1) : NULL;
+    }
+    assert(expected == -1);
+
+    // A second handle on the open file is refused and leaves the first one working
+    assert(magic_pool_open_file(path, 0) == NULL && "Heap file opened twice");
+    assert(magic_pool_check(pool) == MAGIC_OK && magic_pool_root(pool) != NULL);
+
+    // The reopened pool allocates and frees as usual
+    void* more = magic_pool_malloc(pool, 1000);
+    assert(more != NULL && magic_pool_owns(pool, more));
+    magic_pool_free(pool, more);
+    magic_pool_set_mmap_threshold(pool, 1);
+    assert(pool->mmap_threshold == 0 && "Persistent pool took an mmap threshold");
+    MagicPool* plain = magic_pool_create(4096);
+    assert(magic_pool_sync(plain) == -1 && magic_pool_root(plain) == NULL);
+    magic_pool_destroy(plain);
+
+    magic_pool_destroy(pool);
+    munmap(blocker, 256 * 1024);
+    remove(path);
+    TEST_SUCCESS("Persistent Pool Reopen");
+}
+
+// Overwrites bytes of a closed heap file.
+static void damage_file(const char* path, long offset, const void* bytes, size_t count) {
+    FILE* file = fopen(path, "r+b");
+    assert(file != NULL);
+    fseek(file, offset, SEEK_SET);
+    fwrite(bytes, 1, count, file);
+    fclose(file);
+}
+
+void test_persistent_pool_damage() {
+    TEST_START("Persistent Pool Damage");
+
+    const char* path = "magic_test_heap.bin";
+    remove(path);
+    MagicPool* pool = magic_pool_open_file(path, 64 * 1024);
+    char* ptr = magic_pool_malloc(pool, 64);
+    magic_pool_malloc(pool, 64);
+    long header = (long)(ptr - pool->file) - (long)sizeof(size_t);
+    magic_pool_destroy(pool);
+
+    // A block size that breaks the heap is refused on open
+    size_t bad = 12345;
+    damage_file(path, header, &bad, sizeof(bad));
+    assert(magic_pool_open_file(path, 0) == NULL && "Damaged heap was opened");
+    remove(path);
+
+    // So is a file that does not hold a heap
+    pool = magic_pool_open_file(path, 64 * 1024);
+    magic_pool_destroy(pool);
+    damage_file(path, 0, "not a heap", 10);
+    assert(magic_pool_open_file(path, 0) == NULL && "Foreign file was opened");
+    remove(path);
+
+    // Free list and tree links leading out of the heap are refused, not followed
+    for (int fit = MAGIC_FIT_FIRST; fit <= MAGIC_FIT_BEST; fit += MAGIC_FIT_BEST - MAGIC_FIT_FIRST) {
+        pool = magic_pool_open_file(path, 64 * 1024);
+        magic_pool_set_fit(pool, (MagicFitPolicy)fit);
+        char* hole = magic_pool_malloc(pool, 1000);
+        magic_pool_malloc(pool, 64);
+        magic_pool_free(pool, hole);
+        long links = (long)(hole - pool->file);
+        magic_pool_destroy(pool);
+        uint32_t far[2] = { 0xfffffff0u, 0xfffffff0u };
+        damage_file(path, links, far, sizeof(far));
+        assert(magic_pool_open_file(path, 0) == NULL && "Heap with damaged links was opened");
+        remove(path);
+    }
+
+    // A new file too large for a pool is refused and not left behind
+    assert(magic_pool_open_file(path, (size_t)40 << 30) == NULL && "Oversized heap file was opened");
+    assert(access(path, F_OK) != 0 && "Oversized heap file was left behind");
+
+    TEST_SUCCESS("Persistent Pool Damage");
+}
+
+/// ------------------------------- SHARED POOL TESTS ------------------------------- //
+
+void test_shared_pool_handoff() {
+    TEST_START("Shared Pool Handoff");
+
+    char name[64];
+    snprintf(name, sizeof(name), "/magic_test_%d", (int)getpid());
+    MagicSharedPool* shared = magic_shared_pool_create(name, 256 * 1024);
+    assert(shared != NULL && "Could not create shared pool");
+    assert(magic_shared_pool_create(name, 256 * 1024) == NULL && "Created a shared pool twice");
+    char oversized[64];
+    snprintf(oversized, sizeof(oversized), "/magic_test_%d_big", (int)getpid());
+    assert(magic_shared_pool_create(oversized, (size_t)40 << 30) == NULL && "Oversized shared pool was created");
+    assert(magic_shared_pool_unlink(oversized) == -1 && "Oversized shared memory was left behind");
+
+    char* message = magic_shared_pool_malloc(shared, 4000);
+    strcpy(message, "ping");
+    size_t offset = magic_shared_pool_offset(shared, message);
+    int channel[2];
+    assert(pipe(channel) == 0);
+
+    // The child maps the pool again, at another address, takes the message,
+    // frees it and answers with a block of its own
+    pid_t child = fork();
+    if (child == 0) {
+        MagicSharedPool* peer = magic_shared_pool_attach(name);
+        if (!peer || peer->region == shared->region) _exit(1);
+        char* received = magic_shared_pool_pointer(peer, offset);
+        if (strcmp(received, "ping") != 0) _exit(2);
+        magic_shared_pool_free(peer, received);
+        char* reply = magic_shared_pool_malloc(peer, 100);
+        strcpy(reply, "pong");
+        size_t reply_offset = magic_shared_pool_offset(peer, reply);
+        if (write(channel[1], &reply_offset, sizeof(reply_offset)) != sizeof(reply_offset)) _exit(3);
+        magic_shared_pool_detach(peer);
+        _exit(0);
+    }
+    int status;
+    size_t reply_offset = 0;
+    assert(read(channel[0], &reply_offset, sizeof(reply_offset)) == sizeof(reply_offset));
+    assert(waitpid(child, &status, 0) == child && WIFEXITED(status) && WEXITSTATUS(status) == 0 && "Child failed");
+    close(channel[0]);
+    close(channel[1]);
+
+    // Handles are mapped on their own, so many can be open at once
+    static MagicSharedPool* handles[64];
+    for (int i = 0; i < 64; i++) {
+        handles[i] = magic_shared_pool_attach(name);
+        assert(handles[i] != NULL && "Could not open another handle");
+    }
+    for (int i = 0; i < 64; i++) {
+        magic_shared_pool_detach(handles[i]);
+    }
+
+    char* reply = magic_shared_pool_pointer(shared, reply_offset);
+    assert(strcmp(reply, "pong") == 0 && "Reply did not arrive");
+    magic_shared_pool_free(shared, reply);
+    MagicStats stats;
+    magic_pool_stats(shared->pool, &stats);
+    assert(stats.bytes_in_use == 0 && stats.frees == 2 && stats.allocations == 2);
+    assert(magic_shared_pool_check(shared) == MAGIC_OK);
+
+    magic_shared_pool_detach(shared);
+    assert(magic_shared_pool_unlink(name) == 0);
+    assert(magic_shared_pool_attach(name) == NULL && "Attached to an unlinked pool");
+    TEST_SUCCESS("Shared Pool Handoff");
+}
+
+void test_shared_pool_owner_death() {
+    TEST_START("Shared Pool Owner Death");
+
+    char name[64];
+    snprintf(name, sizeof(name), "/magic_test_%d", (int)getpid());
+    MagicSharedPool* shared = magic_shared_pool_create(name, 64 * 1024);
+    char* victim = magic_shared_pool_malloc(shared, 64);
+
+    // A process that dies holding the lock of an intact heap is survived
+    pid_t child = fork();
+    if (child == 0) {
+        MagicSharedPool* peer = magic_shared_pool_attach(name);
+        pthread_mutex_lock(&peer->pool->lock);
+        _exit(0);
+    }
+    waitpid(child, NULL, 0);
+    void* ptr = magic_shared_pool_malloc(shared, 64);
+    assert(ptr != NULL && "Lock of a dead process was not recovered");
+    magic_shared_pool_free(shared, ptr);
+
+    // One that dies halfway through changing it leaves the pool unusable
+    child = fork();
+    if (child == 0) {
+        MagicSharedPool* peer = magic_shared_pool_attach(name);
+        pthread_mutex_lock(&peer->pool->lock);
+        ((size_t*)magic_shared_pool_pointer(peer, magic_shared_pool_offset(shared, victim)))[-1] = 12345;
+        _exit(0);
+    }
+    waitpid(child, NULL, 0);
+    assert(magic_shared_pool_malloc(shared, 64) == NULL && "Damaged shared pool was used");
+    assert(magic_shared_pool_malloc(shared, 64) == NULL);
+
+    magic_shared_pool_detach(shared);
+    magic_shared_pool_unlink(name);
+    TEST_SUCCESS("Shared Pool Owner Death");
+}
+
+/// ------------------------------- CALLOC TESTS ------------------------------- //
+
+void test_calloc_overflow_and_reuse() {
+    TEST_START("Calloc Overflow And Reuse");
+
+    MagicPool* pool = magic_pool_create(256 * 1024);
+
+    // num * size wrapping around is refused instead of allocating the remainder
+#if MAGIC_CHECK_LEVEL >= MAGIC_CHECK_CHECKED
+    magic_set_error_handler(record_error);
+    handled_error = MAGIC_OK;
+#endif
+    assert(magic_pool_calloc(pool, SIZE_MAX / 2 + 2, 2) == NULL && "Overflowing calloc succeeded");
+#if MAGIC_CHECK_LEVEL >= MAGIC_CHECK_CHECKED
+    assert(handled_error == MAGIC_ERROR_INVALID_SIZE);
+    magic_set_error_handler(NULL);
+#endif
+    MagicStats stats;
+    magic_pool_stats(pool, &stats);
+    assert(stats.failed_allocations == 1 && stats.bytes_in_use == 0);
+
+    // Memory that was handed out before is cleared, block metadata included
+    unsigned char* dirty[8];
+    for (int i = 0; i < 8; i++) {
+        dirty[i] = magic_pool_malloc(pool, 3000);
+        memset(dirty[i], 0xff, 3000);
+    }
+    for (int i = 0; i < 8; i++) {
+        magic_pool_free(pool, dirty[i]);
+    }
+    unsigned char* zeroed = magic_pool_calloc(pool, 100, 250);
+    assert(zeroed == dirty[0]);
+    for (size_t i = 0; i < 25000; i++) {
+        assert(zeroed[i] == 0 && "Reused memory was not cleared");
+    }
+    magic_pool_free(pool, zeroed);
+
+    // As is a pool over a caller's buffer, whose contents are unknown
+    static unsigned char buffer[8192];
+    memset(buffer, 0xff, sizeof(buffer));
+    MagicPool* buffered = magic_pool_from_buffer(buffer, sizeof(buffer));
+    unsigned char* small = magic_pool_calloc(buffered, 10, 10);
+    for (int i = 0; i < 100; i++) {
+        assert(small[i] == 0 && "Buffer pool memory was not cleared");
+    }
+    magic_pool_destroy(buffered);
+
+    magic_pool_destroy(pool);
+    TEST_SUCCESS("Calloc Overflow And Reuse");
+}
+
+void test_calloc_fresh_memory() {
+    TEST_START("Calloc Fresh Memory");
+
+    // Heap memory no block has reached yet is zero already and is not touched
+    MagicPool* pool = magic_pool_create(4 * 1024 * 1024);
+    size_t size = 2 * 1024 * 1024;
+    unsigned char* zeroed = magic_pool_calloc(pool, 1, size);
+    assert(zeroed != NULL);
+    assert(resident_pages(zeroed, size) < 8 && "Fresh memory was cleared");
+    for (size_t i = 0; i < size; i += 512) {
+        assert(zeroed[i] == 0);
+    }
+
+    // Once written and freed, it is cleared on the next calloc
+    memset(zeroed, 0xff, size);
+    magic_pool_free(pool, zeroed);
+    zeroed = magic_pool_calloc(pool, 2, size / 2);
+    for (size_t i = 0; i < size; i++) {
+        assert(zeroed[i] == 0 && "Reused memory was not cleared");
+    }
+    magic_pool_free(pool, zeroed);
+    magic_pool_destroy(pool);
+
+    // Growing merges new pages into a free tail whose old boundary tag lies
+    // past the fresh mark; the block spanning both must still read as zeros
+    MagicPool* growable = magic_pool_create_growable(64 * 1024, 16 * 1024 * 1024);
+    void* first = magic_pool_malloc(growable, 1000);
+    memset(first, 0xff, 1000);
+    unsigned char* spanning = magic_pool_calloc(growable, 1, 1024 * 1024);
+    assert(spanning != NULL);
+    for (size_t i = 0; i < 1024 * 1024; i++) {
+        assert(spanning[i] == 0 && "Grown memory was not zero");
+    }
+    assert(magic_pool_check(growable) == MAGIC_OK);
+    magic_pool_free(growable, spanning);
+    magic_pool_free(growable, first);
+    magic_pool_destroy(growable);
+
+    TEST_SUCCESS("Calloc Fresh Memory");
+}
+
 // Run all tests
 void run_all_tests() {
     test_allocate_full_pool();
@@ -406,7 +2504,9 @@ void run_all_tests() {
     test_allocate_larger_than_pool();
     test_allocate_and_free_all();
     //test_fragmentation_and_coalescing();
+#if MAGIC_CHECK_LEVEL >= MAGIC_CHECK_CHECKED
     test_double_free();
+#endif
     test_calloc();
     test_realloc_null_pointer();
     test_realloc_smaller_size();
@@ -418,10 +2518,131 @@ void run_all_tests() {
 void run_performace_tests(){
     test_worst_case_malloc();
     test_worst_case_free();
+    test_worst_case_latency();
+    test_thread_scaling();
 }
 
 void run_coalesing_tests(){
     test_right_coalescing();
     test_left_coalescing();
     test_full_coalescing();
+    test_boundary_tags();
+}
+
+void run_pool_tests(){
+    test_pool_create_large();
+    test_pool_from_buffer();
+    test_pools_are_isolated();
+}
+
+void run_size_class_tests(){
+    test_exact_bin_reuse();
+    test_bitmap_tracks_bins();
+    test_compact_header();
+}
+
+void run_tlsf_tests(){
+    test_tlsf_alloc_free();
+    test_tlsf_good_fit();
+}
+
+void run_thread_tests(){
+    test_thread_cache_reuse();
+    test_concurrent_alloc();
+}
+
+void run_realloc_tests(){
+    test_realloc_grow_into_neighbour();
+    test_realloc_move_when_blocked();
+    test_realloc_growing_buffer();
+}
+
+void run_buddy_tests(){
+    test_buddy_split_merge();
+    test_buddy_realloc();
+}
+
+void run_trace_tests(){
+#ifndef _WIN32
+    test_trace_records();
+    test_trace_ring_wraps();
+#endif
+}
+
+void run_stats_tests(){
+    test_stats_track_heap();
+    test_stats_count_cached_calls();
+}
+
+void run_check_tests(){
+#if MAGIC_CHECK_LEVEL >= MAGIC_CHECK_CHECKED
+    test_error_handler();
+#endif
+    test_heap_check();
+}
+
+void run_alignment_tests(){
+    test_memalign_returns_slack();
+    test_posix_memalign();
+}
+
+void run_batch_tests(){
+    test_batch_contiguous();
+    test_batch_partial();
+}
+
+void run_growth_tests(){
+    test_growable_pool();
+    test_growable_tail_merge();
+}
+
+void run_large_block_tests(){
+    test_large_blocks_bypass_pool();
+    test_large_realloc();
+}
+
+void run_purge_tests(){
+    test_trim_purges_free_pages();
+    test_purged_merge_count();
+    test_purge_decay();
+}
+
+void run_fit_tests(){
+    test_best_fit();
+    test_next_fit_and_switching();
+}
+
+void run_arena_tests(){
+    test_arena_bump_and_reset();
+    test_arena_mark_rewind();
+}
+
+void run_shard_tests(){
+    test_sharded_pool_routing();
+    test_sharded_pool_spill();
+}
+
+void run_slab_tests(){
+    test_slab_alloc_free();
+    test_slab_threads();
+}
+
+void run_fast_bin_tests(){
+    test_fast_bin_reuse();
+    test_fast_bin_consolidation();
+}
+
+void run_persist_tests(){
+    test_persistent_pool_reopen();
+    test_persistent_pool_damage();
+}
+
+void run_shared_pool_tests(){
+    test_shared_pool_handoff();
+    test_shared_pool_owner_death();
+}
+
+void run_calloc_tests(){
+    test_calloc_overflow_and_reuse();
+    test_calloc_fresh_memory();
 }